@@ -0,0 +1,664 @@
+// Name: Liam Hearder       Student Number: 23074422
+// Name: Pranav Menon       Student Number: 24069351
+
+
+// ~~~~~~~~~~~~~~ CONTENTS ~~~~~~~~~~~~~~ //
+// 1. Includes and Defines
+// 2. Engines
+// 3. parse_list() / list_contains()
+// 4. compute_statistics()
+// 5. run_case()
+// 6. write_metric() / write_csv() / write_json()
+// 7. Machine peaks: measure_triad_bandwidth(), measure_peak_gflops()
+// 8. run_scaling_study()
+// 9. main()
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ //
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+
+#include "conv2d.h"
+
+// The most values accepted in one comma-separated option, e.g. -s 256,512,1024
+#define MAX_LIST_LENGTH 32
+
+// Defaults for the sweep, used when the matching option isn't given
+#define DEFAULT_SIZES "256,512,1024,2048"
+#define DEFAULT_KERNELS "3,5,9"
+#define DEFAULT_WARMUPS 2
+#define DEFAULT_RUNS 10
+
+// Floats in each STREAM triad array. Three 64 MB arrays, comfortably larger than any last-level cache.
+#define TRIAD_LENGTH (16 * 1024 * 1024)
+#define TRIAD_REPEATS 5
+
+// The peak FLOP/s loop keeps this many independent accumulator vectors per thread, enough to cover the
+// FMA latency on current cores, each PEAK_LANES floats wide so the compiler emits full-width vector FMAs
+#define PEAK_CHAINS 8
+#define PEAK_LANES 16
+#define PEAK_ITERATIONS 20000000
+
+// Every engine is called through this signature, regardless of how it takes its output
+typedef int (*bench_engine)(float* f, int H, int W, float* g, int kH, int kW, int w_padding, int h_padding, float* output);
+
+typedef struct {
+    const char* name;
+    bench_engine run;
+    int parallel;       // Serial engines are only run with one thread
+} engine_entry;
+
+// Timing statistics and derived throughput for one (engine, size, kernel, threads) case
+typedef struct {
+    const char* engine;
+    int H, W, kH, kW, threads, runs;
+    double min, median, p95, mean, stddev;  // Seconds
+    double gflops;                          // At the median time
+    double bandwidth;                       // GB/s of compulsory traffic at the median time
+
+    // Only filled in with -perf, over all timed runs. Negative when unavailable.
+    double ipc;
+    double measured_gflops;                 // From the FP counters, rather than the analytic FLOP count
+    double llc_intensity;                   // FLOP per byte of LLC miss traffic
+    long long l1d_misses, llc_misses, dtlb_misses;
+} bench_result;
+
+
+/*
+* Adapter for parallel_conv2d(), which takes its output as a float_array.
+*/
+int run_parallel_conv2d(float* f, int H, int W, float* g, int kH, int kW, int w_padding, int h_padding, float* output){
+    return parallel_conv2d(f, H, W, g, kH, kW, w_padding, h_padding, (float_array){ output, NULL });
+}
+
+/*
+* Adapters for accumulate_conv2d(), one per accumulator policy.
+*/
+int run_fp64_conv2d(float* f, int H, int W, float* g, int kH, int kW, int w_padding, int h_padding, float* output){
+    return accumulate_conv2d(f, H, W, g, kH, kW, w_padding, h_padding, output, ACCUMULATE_FP64);
+}
+int run_pairwise_conv2d(float* f, int H, int W, float* g, int kH, int kW, int w_padding, int h_padding, float* output){
+    return accumulate_conv2d(f, H, W, g, kH, kW, w_padding, h_padding, output, ACCUMULATE_PAIRWISE);
+}
+int run_kahan_conv2d(float* f, int H, int W, float* g, int kH, int kW, int w_padding, int h_padding, float* output){
+    return accumulate_conv2d(f, H, W, g, kH, kW, w_padding, h_padding, output, ACCUMULATE_KAHAN);
+}
+
+/*
+* Adapter for pool_conv2d(), sizing the built-in pool to the current thread count.
+*/
+int run_pool_conv2d(float* f, int H, int W, float* g, int kH, int kW, int w_padding, int h_padding, float* output){
+    if (thread_pool_start(omp_get_max_threads()) != 0) { return 1; }
+    return pool_conv2d(f, H, W, g, kH, kW, w_padding, h_padding, output);
+}
+
+engine_entry engines[] = {
+    { "serial", conv2d, 0 },
+    { "parallel", run_parallel_conv2d, 1 },
+    { "deterministic", deterministic_conv2d, 1 },
+    { "sliding", sliding_conv2d, 1 },
+    { "tiled", tiled_conv2d, 1 },
+    { "pool", run_pool_conv2d, 1 },
+    { "fp64", run_fp64_conv2d, 1 },
+    { "pairwise", run_pairwise_conv2d, 1 },
+    { "kahan", run_kahan_conv2d, 1 },
+    { "transpose", conv2d_transpose, 1 },
+};
+const int engine_count = sizeof(engines) / sizeof(engines[0]);
+
+
+/*
+* Parses a comma-separated list of positive integers, e.g. "1,2,4".
+* @param text       The list to parse.
+* @param values     The array into which the values will be stored. Must hold MAX_LIST_LENGTH values.
+* @return           The number of values parsed, or 0 if any value is invalid.
+*/
+int parse_list(const char* text, int* values){
+
+    char copy[256];
+    snprintf(copy, sizeof(copy), "%s", text);
+
+    int count = 0;
+    char* token = strtok(copy, ",");
+    while (token != NULL && count < MAX_LIST_LENGTH){
+        values[count] = atoi(token);
+        if (values[count] < 1) { return 0; }
+        count++;
+        token = strtok(NULL, ",");
+    }
+    return count;
+}
+
+
+/*
+* Checks whether a comma-separated list contains a name exactly.
+*/
+int list_contains(const char* list, const char* name){
+    const size_t length = strlen(name);
+    for (const char* item = list; item != NULL; item = strchr(item, ',')){
+        if (*item == ',') { item++; }
+        if (strncmp(item, name, length) == 0 && (item[length] == ',' || item[length] == '\0')) { return 1; }
+    }
+    return 0;
+}
+
+
+int compare_doubles(const void* a, const void* b){
+    const double x = *(const double*)a;
+    const double y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+
+/*
+* Fills in the timing statistics of a result from its raw run times.
+* @param times      The time of each run, in seconds. Sorted in place.
+* @param runs       The number of runs.
+* @param result     The result to fill in.
+*/
+int compute_statistics(double* times, int runs, bench_result* result){
+
+    qsort(times, runs, sizeof(double), compare_doubles);
+
+    double sum = 0.0;
+    for (int i = 0; i < runs; i++) { sum += times[i]; }
+    const double mean = sum / runs;
+
+    double squares = 0.0;
+    for (int i = 0; i < runs; i++) { squares += (times[i] - mean) * (times[i] - mean); }
+
+    // Nearest-rank percentiles
+    result->min = times[0];
+    result->median = runs % 2 ? times[runs / 2] : 0.5 * (times[runs / 2 - 1] + times[runs / 2]);
+    result->p95 = times[min(runs - 1, (int)ceil(0.95 * runs) - 1)];
+    result->mean = mean;
+    result->stddev = runs > 1 ? sqrt(squares / (runs - 1)) : 0.0;
+    result->runs = runs;
+    return 0;
+}
+
+
+/*
+* Times one engine on one problem, after a number of untimed warmup runs.
+* @param engine     The engine to run.
+* @param f          The padded feature map.
+* @param g          The kernel.
+* @param output     The output buffer.
+* @param warmups    The number of untimed runs.
+* @param runs       The number of timed runs.
+* @param perf_mode  Whether to collect hardware counters over the timed runs.
+* @param result     The result to fill in. Dimensions and threads must already be set.
+*/
+int run_case(engine_entry* engine, float* f, float* g, float* output, int warmups, int runs, int perf_mode, bench_result* result){
+
+    const int H = result->H, W = result->W, kH = result->kH, kW = result->kW;
+    const int padding_height = kH / 2, padding_width = kW / 2;
+
+    double* times = (double*)malloc(runs * sizeof(double));
+    if (times == NULL) { return 1; }
+
+    perf_counts counts = {0};
+    double counted_seconds = 0.0;
+
+    for (int i = 0; i < warmups + runs; i++){
+        if (perf_mode && i >= warmups) { start_perf_counters(); }
+        const double start_time = omp_get_wtime();
+        if (engine->run(f, H, W, g, kH, kW, padding_width, padding_height, output) != 0){
+            free(times);
+            return 1;
+        }
+        if (i >= warmups) { times[i - warmups] = omp_get_wtime() - start_time; }
+        if (perf_mode && i >= warmups){
+            stop_perf_counters(&counts, NULL);
+            counted_seconds += times[i - warmups];
+        }
+    }
+
+    compute_statistics(times, runs, result);
+    free(times);
+
+    // Each output needs one multiply and one add per kernel tap. The compulsory traffic is reading
+    // the padded feature map and the kernel once, and writing the outputs once.
+    const double flops = 2.0 * H * W * kH * kW;
+    const double bytes = sizeof(float) * ((double)(H + 2 * padding_height) * (W + 2 * padding_width) + (double)kH * kW + (double)H * W);
+    result->engine = engine->name;
+    result->gflops = flops / result->median * 1e-9;
+    result->bandwidth = bytes / result->median * 1e-9;
+
+    const long long* v = counts.values;
+    const long long fp_ops = perf_fp_ops(&counts);
+    result->ipc = perf_mode && v[PERF_CYCLES] > 0 && v[PERF_INSTRUCTIONS] >= 0 ? (double)v[PERF_INSTRUCTIONS] / v[PERF_CYCLES] : -1.0;
+    result->measured_gflops = perf_mode && fp_ops >= 0 ? fp_ops / counted_seconds * 1e-9 : -1.0;
+    result->llc_intensity = perf_mode && v[PERF_LLC_MISSES] > 0 ? flops * runs / (64.0 * v[PERF_LLC_MISSES]) : -1.0;
+    result->l1d_misses = perf_mode ? v[PERF_L1D_MISSES] : -1;
+    result->llc_misses = perf_mode ? v[PERF_LLC_MISSES] : -1;
+    result->dtlb_misses = perf_mode ? v[PERF_DTLB_MISSES] : -1;
+    return 0;
+}
+
+
+/*
+* Writes one optional metric, or a placeholder when it is negative (unavailable).
+*/
+void write_metric(FILE* file_ptr, const char* prefix, const char* format, double value, const char* placeholder){
+    fputs(prefix, file_ptr);
+    if (value < 0.0){
+        fputs(placeholder, file_ptr);
+    } else {
+        fprintf(file_ptr, format, value);
+    }
+}
+
+
+/*
+* Writes the results as CSV, one row per case.
+*/
+int write_csv(char* filepath, bench_result* results, int count){
+    FILE* file_ptr = fopen(filepath, "w");
+    if (file_ptr == NULL){ return 1; }
+
+    fprintf(file_ptr, "engine,H,W,kH,kW,threads,runs,min_s,median_s,p95_s,mean_s,stddev_s,gflops,bandwidth_gbs,"
+        "ipc,measured_gflops,llc_intensity,l1d_misses,llc_misses,dtlb_misses\n");
+    for (int i = 0; i < count; i++){
+        bench_result* r = &results[i];
+        fprintf(file_ptr, "%s,%d,%d,%d,%d,%d,%d,%.9f,%.9f,%.9f,%.9f,%.9f,%.4f,%.4f",
+            r->engine, r->H, r->W, r->kH, r->kW, r->threads, r->runs,
+            r->min, r->median, r->p95, r->mean, r->stddev, r->gflops, r->bandwidth);
+
+        // Unavailable counters are left empty
+        write_metric(file_ptr, ",", "%.4f", r->ipc, "");
+        write_metric(file_ptr, ",", "%.4f", r->measured_gflops, "");
+        write_metric(file_ptr, ",", "%.4f", r->llc_intensity, "");
+        write_metric(file_ptr, ",", "%.0f", (double)r->l1d_misses, "");
+        write_metric(file_ptr, ",", "%.0f", (double)r->llc_misses, "");
+        write_metric(file_ptr, ",", "%.0f", (double)r->dtlb_misses, "");
+        fprintf(file_ptr, "\n");
+    }
+    fclose(file_ptr);
+    return 0;
+}
+
+
+/*
+* Writes the results as JSON, with a little information about the run for tracking over time.
+*/
+int write_json(char* filepath, bench_result* results, int count, int warmups){
+    FILE* file_ptr = fopen(filepath, "w");
+    if (file_ptr == NULL){ return 1; }
+
+    fprintf(file_ptr, "{\n  \"timestamp\": %ld,\n  \"processors\": %d,\n  \"warmups\": %d,\n  \"results\": [\n",
+        (long)time(NULL), omp_get_num_procs(), warmups);
+    for (int i = 0; i < count; i++){
+        bench_result* r = &results[i];
+        fprintf(file_ptr, "    {\"engine\": \"%s\", \"H\": %d, \"W\": %d, \"kH\": %d, \"kW\": %d, \"threads\": %d, \"runs\": %d, "
+            "\"min_s\": %.9f, \"median_s\": %.9f, \"p95_s\": %.9f, \"mean_s\": %.9f, \"stddev_s\": %.9f, "
+            "\"gflops\": %.4f, \"bandwidth_gbs\": %.4f",
+            r->engine, r->H, r->W, r->kH, r->kW, r->threads, r->runs,
+            r->min, r->median, r->p95, r->mean, r->stddev, r->gflops, r->bandwidth);
+
+        // Unavailable counters are written as null
+        write_metric(file_ptr, ", \"ipc\": ", "%.4f", r->ipc, "null");
+        write_metric(file_ptr, ", \"measured_gflops\": ", "%.4f", r->measured_gflops, "null");
+        write_metric(file_ptr, ", \"llc_intensity\": ", "%.4f", r->llc_intensity, "null");
+        write_metric(file_ptr, ", \"l1d_misses\": ", "%.0f", (double)r->l1d_misses, "null");
+        write_metric(file_ptr, ", \"llc_misses\": ", "%.0f", (double)r->llc_misses, "null");
+        write_metric(file_ptr, ", \"dtlb_misses\": ", "%.0f", (double)r->dtlb_misses, "null");
+        fprintf(file_ptr, "}%s\n", i + 1 < count ? "," : "");
+    }
+    fprintf(file_ptr, "  ]\n}\n");
+    fclose(file_ptr);
+    return 0;
+}
+
+
+/*
+* Measures the sustainable memory bandwidth with a STREAM-style triad, a[i] = b[i] + s * c[i].
+* Counts 12 bytes per element, as STREAM does, so write-allocate traffic is not included.
+* @param threads    The number of threads to use.
+* @return           The best bandwidth over TRIAD_REPEATS runs, in GB/s, or a negative value on error.
+*/
+double measure_triad_bandwidth(int threads){
+
+    float_buffer a = {0}, b = {0}, c = {0};
+    if (reserve_buffer(&a, TRIAD_LENGTH, PAGES_DEFAULT) != 0 || reserve_buffer(&b, TRIAD_LENGTH, PAGES_DEFAULT) != 0 ||
+        reserve_buffer(&c, TRIAD_LENGTH, PAGES_DEFAULT) != 0){
+        release_buffer(&a); release_buffer(&b); release_buffer(&c);
+        return -1.0;
+    }
+
+    float* restrict x = a.arr;
+    float* restrict y = b.arr;
+    float* restrict z = c.arr;
+    const float scalar = 3.0f;
+
+    // First touch with the same static partition as the triad itself
+    #pragma omp parallel for schedule(static) num_threads(threads)
+    for (long i = 0; i < TRIAD_LENGTH; i++){
+        x[i] = 0.0f; y[i] = 1.0f; z[i] = 2.0f;
+    }
+
+    double best = 1e30;
+    for (int repeat = 0; repeat < TRIAD_REPEATS; repeat++){
+        const double start_time = omp_get_wtime();
+
+        #pragma omp parallel for simd schedule(static) num_threads(threads)
+        for (long i = 0; i < TRIAD_LENGTH; i++){
+            x[i] = y[i] + scalar * z[i];
+        }
+        best = min(best, omp_get_wtime() - start_time);
+    }
+
+    release_buffer(&a); release_buffer(&b); release_buffer(&c);
+    return 3.0 * sizeof(float) * TRIAD_LENGTH / best * 1e-9;
+}
+
+
+/*
+* Measures the peak single precision FLOP/s with independent chains of vector multiply-adds held in registers.
+* @param threads    The number of threads to use.
+* @return           The achieved GFLOP/s, counting each multiply-add as two operations.
+*/
+double measure_peak_gflops(int threads){
+
+    float sink = 0.0f;
+    const double start_time = omp_get_wtime();
+
+    #pragma omp parallel num_threads(threads) reduction(+:sink)
+    {
+        float acc[PEAK_CHAINS][PEAK_LANES];
+        for (int c = 0; c < PEAK_CHAINS; c++){
+            for (int l = 0; l < PEAK_LANES; l++) { acc[c][l] = (float)(c + l) * 1e-3f; }
+        }
+
+        // Chosen so the accumulators converge instead of overflowing
+        const float multiplier = 0.999999f, addend = 1e-7f;
+
+        for (long iteration = 0; iteration < PEAK_ITERATIONS; iteration++){
+            for (int c = 0; c < PEAK_CHAINS; c++){
+                #pragma omp simd
+                for (int l = 0; l < PEAK_LANES; l++){
+                    acc[c][l] = acc[c][l] * multiplier + addend;
+                }
+            }
+        }
+
+        // Use the results, so the loop can't be optimised away
+        for (int c = 0; c < PEAK_CHAINS; c++){
+            for (int l = 0; l < PEAK_LANES; l++) { sink += acc[c][l]; }
+        }
+    }
+
+    const double seconds = omp_get_wtime() - start_time;
+    if (sink == 12345.0f) { printf(" "); }
+
+    return 2.0 * PEAK_CHAINS * PEAK_LANES * (double)PEAK_ITERATIONS * threads / seconds * 1e-9;
+}
+
+
+/*
+* Runs strong- and weak-scaling sweeps over the thread counts for every selected engine, and places each
+* result on the roofline of the machine measured at the same thread count.
+*   - Strong scaling keeps the problem at size x size, so ideal times fall as 1/threads.
+*   - Weak scaling gives every thread size rows of size columns, so ideal times stay flat.
+* @param engine_list    The engines to run, or NULL for all of them.
+* @param size           The feature map size for strong scaling, and the rows per thread for weak scaling.
+* @param kernel_size    The square kernel size.
+* @param thread_counts  The thread counts to sweep. The first is the baseline for speedups.
+* @param thread_count   The number of thread counts.
+* @param warmups        The number of untimed runs per case.
+* @param runs           The number of timed runs per case.
+* @param csv_file       Optional file for the results as CSV.
+*/
+int run_scaling_study(char* engine_list, int size, int kernel_size, int* thread_counts, int thread_count, int warmups, int runs, char* csv_file){
+
+    // ~~~~~~~~~~~~~~~ Machine peaks ~~~~~~~~~~~~~~ //
+
+    double peak_bandwidth[MAX_LIST_LENGTH], peak_gflops[MAX_LIST_LENGTH];
+    int largest_threads = 1;
+
+    printf("Machine peaks:\n%6s %14s %14s %16s\n", "thr", "triad GB/s", "peak GFLOP/s", "ridge FLOP/byte");
+    for (int t = 0; t < thread_count; t++){
+        peak_bandwidth[t] = measure_triad_bandwidth(thread_counts[t]);
+        peak_gflops[t] = measure_peak_gflops(thread_counts[t]);
+        largest_threads = max(largest_threads, thread_counts[t]);
+        if (peak_bandwidth[t] < 0.0){
+            printf("Error allocating memory for the triad.\n");
+            return 1;
+        }
+        printf("%6d %14.3f %14.3f %16.3f\n", thread_counts[t], peak_bandwidth[t], peak_gflops[t], peak_gflops[t] / peak_bandwidth[t]);
+    }
+
+    // ~~~~~~~~~~~~~~~ Buffers ~~~~~~~~~~~~~~ //
+
+    // The largest weak-scaling problem has size rows for each of the most threads
+    const int padding = kernel_size / 2;
+    const int largest_rows = size * largest_threads;
+    float_buffer kernel_buffer = {0}, feature_buffer = {0}, output_buffer = {0};
+    if (reserve_buffer(&kernel_buffer, (size_t)kernel_size * kernel_size, PAGES_DEFAULT) != 0 ||
+        reserve_buffer(&feature_buffer, (size_t)(largest_rows + 2 * padding) * (size + 2 * padding), PAGES_DEFAULT) != 0 ||
+        reserve_buffer(&output_buffer, (size_t)largest_rows * size, PAGES_DEFAULT) != 0){
+        printf("Error allocating memory for scaling buffers.\n");
+        return 1;
+    }
+    float* kernel = kernel_buffer.arr;
+    float* feature_map = feature_buffer.arr;
+
+    FILE* csv_ptr = NULL;
+    if (csv_file != NULL){
+        csv_ptr = fopen(csv_file, "w");
+        if (csv_ptr == NULL){ printf("Error opening CSV file.\n"); return 1; }
+        fprintf(csv_ptr, "study,engine,threads,H,W,kH,kW,median_s,speedup,efficiency,gflops,intensity,attainable_gflops,roofline_fraction,bound\n");
+    }
+
+    // ~~~~~~~~~~~~~~~ Sweeps ~~~~~~~~~~~~~~ //
+
+    const char* studies[2] = { "strong", "weak" };
+    for (int study = 0; study < 2; study++){
+
+        printf("\n%s scaling (%s):\n", study == 0 ? "Strong" : "Weak",
+            study == 0 ? "fixed problem, speedup = T(base) / T(p)" : "fixed work per thread, efficiency = T(base) / T(p)");
+        printf("%-14s %4s %6s %6s %11s %9s %9s %9s %9s %11s %9s %7s\n", "engine", "thr", "H", "W", "median(s)",
+            "speedup", "effic.", "GFLOP/s", "FLOP/B", "attainable", "% roof", "bound");
+
+        for (int e = 0; e < engine_count; e++){
+
+            if (engine_list != NULL && !list_contains(engine_list, engines[e].name)) { continue; }
+            double baseline_time = 0.0;
+            int baseline_threads = 1;
+
+            for (int t = 0; t < thread_count; t++){
+
+                const int threads = engines[e].parallel ? thread_counts[t] : 1;
+                if (!engines[e].parallel && t > 0) { break; }
+                const int H = study == 0 ? size : size * threads;
+
+                omp_set_num_threads(threads);
+                generate_data(kernel_size, kernel_size, 0, 0, &kernel);
+                generate_data(H, size, padding, padding, &feature_map);
+
+                bench_result result = { .H = H, .W = size, .kH = kernel_size, .kW = kernel_size, .threads = threads };
+                if (run_case(&engines[e], feature_map, kernel, output_buffer.arr, warmups, runs, 0, &result) != 0){
+                    printf("Error running %s.\n", engines[e].name);
+                    return 1;
+                }
+
+                if (t == 0) { baseline_time = result.median; baseline_threads = threads; }
+
+                // Strong scaling compares times directly. Weak scaling does too, since ideal times are constant,
+                // and its speedup is the scaled speedup: how much more work was done in the same time.
+                const double ratio = baseline_time / result.median;
+                const double speedup = study == 0 ? ratio : ratio * threads / baseline_threads;
+                const double efficiency = study == 0 ? ratio * baseline_threads / threads : ratio;
+
+                // Roofline position, using the compulsory traffic for the arithmetic intensity
+                const double intensity = result.gflops / result.bandwidth;
+                const double attainable = min(peak_gflops[t], intensity * peak_bandwidth[t]);
+                const char* bound = intensity * peak_bandwidth[t] < peak_gflops[t] ? "memory" : "compute";
+
+                printf("%-14s %4d %6d %6d %11.6f %9.3f %9.3f %9.3f %9.3f %11.3f %8.1f%% %7s\n",
+                    engines[e].name, threads, H, size, result.median, speedup, efficiency,
+                    result.gflops, intensity, attainable, 100.0 * result.gflops / attainable, bound);
+
+                if (csv_ptr != NULL){
+                    fprintf(csv_ptr, "%s,%s,%d,%d,%d,%d,%d,%.9f,%.4f,%.4f,%.4f,%.4f,%.4f,%.4f,%s\n",
+                        studies[study], engines[e].name, threads, H, size, kernel_size, kernel_size, result.median,
+                        speedup, efficiency, result.gflops, intensity, attainable, result.gflops / attainable, bound);
+                }
+            }
+        }
+    }
+
+    if (csv_ptr != NULL) { fclose(csv_ptr); }
+    release_buffer(&output_buffer);
+    release_buffer(&feature_buffer);
+    release_buffer(&kernel_buffer);
+    return 0;
+}
+
+
+int main(int argc, char** argv) {
+
+    // ~~~~~~~~~~~~~~~ MAIN CONTENTS ~~~~~~~~~~~~~~ //
+    // 1. Argument Extraction
+    // 2. Sweep
+    // 3. Write Results
+    // ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ //
+
+
+    // ~~~~~~~~~~~~~~~ 1. Argument Extraction ~~~~~~~~~~~~~~ //
+
+    srand(time(0));
+
+    int sizes[MAX_LIST_LENGTH], kernels[MAX_LIST_LENGTH], thread_counts[MAX_LIST_LENGTH];
+    int size_count = parse_list(DEFAULT_SIZES, sizes);     // -s <list>
+    int kernel_count = parse_list(DEFAULT_KERNELS, kernels); // -k <list>
+    int thread_count = 0;                                   // -t <list>
+    char* engine_list = NULL;                               // -a <list>
+    int warmups = DEFAULT_WARMUPS;                          // -w <int>
+    int runs = DEFAULT_RUNS;                                // -r <int>
+    char* csv_file = NULL;                                  // -csv <path>
+    char* json_file = NULL;                                 // -json <path>
+    int perf_mode = 0;                                      // -perf
+    int scaling_mode = 0;                                   // -scaling
+
+    // Default thread counts are the powers of two up to the machine's maximum, plus the maximum itself
+    const int max_threads = omp_get_max_threads();
+    for (int t = 1; t < max_threads && thread_count < MAX_LIST_LENGTH - 1; t *= 2) { thread_counts[thread_count++] = t; }
+    thread_counts[thread_count++] = max_threads;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-perf") == 0) { perf_mode = 1; continue; }
+        if (strcmp(argv[i], "-scaling") == 0) { scaling_mode = 1; continue; }
+        if (i + 1 >= argc) { printf("Incorrect usage of %s flag. Please provide a value.\n", argv[i]); return 1; }
+
+        if (strcmp(argv[i], "-s") == 0) { size_count = parse_list(argv[++i], sizes); continue; }
+        if (strcmp(argv[i], "-k") == 0) { kernel_count = parse_list(argv[++i], kernels); continue; }
+        if (strcmp(argv[i], "-t") == 0) { thread_count = parse_list(argv[++i], thread_counts); continue; }
+        if (strcmp(argv[i], "-a") == 0) { engine_list = argv[++i]; continue; }
+        if (strcmp(argv[i], "-w") == 0) { warmups = atoi(argv[++i]); continue; }
+        if (strcmp(argv[i], "-r") == 0) { runs = atoi(argv[++i]); continue; }
+        if (strcmp(argv[i], "-csv") == 0) { csv_file = argv[++i]; continue; }
+        if (strcmp(argv[i], "-json") == 0) { json_file = argv[++i]; continue; }
+
+        printf("Unknown flag %s.\n", argv[i]);
+        return 1;
+    }
+
+    if (size_count == 0 || kernel_count == 0 || thread_count == 0 || warmups < 0 || runs < 1){
+        printf("Please provide only positive integers for sizes, kernels, threads and runs.\n");
+        return 1;
+    }
+
+    // The scaling study uses the first size and kernel, and its own buffers
+    if (scaling_mode){
+        return run_scaling_study(engine_list, sizes[0], kernels[0], thread_counts, thread_count, warmups, runs, csv_file);
+    }
+
+    // Work out the largest problem, so every buffer is allocated once for the whole sweep
+    int largest_size = 0, largest_kernel = 0;
+    for (int i = 0; i < size_count; i++) { largest_size = max(largest_size, sizes[i]); }
+    for (int i = 0; i < kernel_count; i++) { largest_kernel = max(largest_kernel, kernels[i]); }
+    const size_t largest_padded = (size_t)(largest_size + largest_kernel) * (largest_size + largest_kernel);
+
+    float_buffer kernel_buffer = {0}, feature_buffer = {0}, output_buffer = {0};
+    if (reserve_buffer(&kernel_buffer, (size_t)largest_kernel * largest_kernel, PAGES_DEFAULT) != 0 ||
+        reserve_buffer(&feature_buffer, largest_padded, PAGES_DEFAULT) != 0 ||
+        reserve_buffer(&output_buffer, (size_t)largest_size * largest_size, PAGES_DEFAULT) != 0){
+        printf("Error allocating memory for benchmark buffers.\n");
+        return 1;
+    }
+
+    const int max_results = engine_count * size_count * kernel_count * thread_count;
+    bench_result* results = (bench_result*)calloc(max_results, sizeof(bench_result));
+    int result_count = 0;
+
+
+    // ~~~~~~~~~~~~~~~ 2. Sweep ~~~~~~~~~~~~~~ //
+
+    printf("%-14s %6s %6s %4s %4s %4s %11s %11s %11s %10s %9s %9s\n",
+        "engine", "H", "W", "kH", "kW", "thr", "min(s)", "median(s)", "p95(s)", "stddev(s)", "GFLOP/s", "GB/s");
+
+    for (int s = 0; s < size_count; s++){
+        for (int k = 0; k < kernel_count; k++){
+
+            const int size = sizes[s], kernel_size = kernels[k];
+            float* feature_map = feature_buffer.arr;
+            float* kernel = kernel_buffer.arr;
+
+            // Inputs are generated with the largest thread count, so pages are spread as widely as possible
+            omp_set_num_threads(max_threads);
+            generate_data(kernel_size, kernel_size, 0, 0, &kernel);
+            generate_data(size, size, kernel_size / 2, kernel_size / 2, &feature_map);
+
+            for (int e = 0; e < engine_count; e++){
+
+                if (engine_list != NULL && !list_contains(engine_list, engines[e].name)) { continue; }
+
+                for (int t = 0; t < thread_count; t++){
+
+                    if (!engines[e].parallel && t > 0) { break; }
+                    const int threads = engines[e].parallel ? thread_counts[t] : 1;
+                    omp_set_num_threads(threads);
+
+                    bench_result* result = &results[result_count];
+                    *result = (bench_result){ .H = size, .W = size, .kH = kernel_size, .kW = kernel_size, .threads = threads };
+
+                    if (run_case(&engines[e], feature_map, kernel, output_buffer.arr, warmups, runs, perf_mode, result) != 0){
+                        printf("Error running %s.\n", engines[e].name);
+                        return 1;
+                    }
+                    result_count++;
+
+                    printf("%-14s %6d %6d %4d %4d %4d %11.6f %11.6f %11.6f %10.6f %9.3f %9.3f\n",
+                        result->engine, result->H, result->W, result->kH, result->kW, result->threads,
+                        result->min, result->median, result->p95, result->stddev, result->gflops, result->bandwidth);
+                    if (perf_mode && result->ipc >= 0.0){
+                        printf("%-14s IPC %.3f, LLC misses %lld, FLOP per LLC miss byte %.3f\n", "", result->ipc, result->llc_misses, result->llc_intensity);
+                    }
+                }
+            }
+        }
+    }
+
+
+    // ~~~~~~~~~~~~~~~ 3. Write Results ~~~~~~~~~~~~~~ //
+
+    if (csv_file != NULL && write_csv(csv_file, results, result_count) != 0){
+        printf("Error writing CSV results.\n");
+        return 1;
+    }
+    if (json_file != NULL && write_json(json_file, results, result_count, warmups) != 0){
+        printf("Error writing JSON results.\n");
+        return 1;
+    }
+
+    free(results);
+    release_buffer(&output_buffer);
+    release_buffer(&feature_buffer);
+    release_buffer(&kernel_buffer);
+
+    return 0;
+}
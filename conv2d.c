@@ -6,37 +6,67 @@
 // 1. Includes and Defines
 // 2. extract_dimensions()
 // 3. extract_data()
-// 4. conv2d()
-// 5. parallel_conv2d()
-// 6. write_data_to_file()
-// 7. generate_data()
-// 8. main()
+// 4. Binary I/O: read_binary_header(), extract_binary_data(), write_binary_file()
+// 5. Epilogues: parse_epilogue(), set_conv2d_epilogue(), apply_epilogue(), apply_epilogue_reference()
+// 6. conv2d()
+// 7. parallel_conv2d()
+// 8. deterministic_conv2d()
+// 9. sliding_conv2d()
+// 10. Tiled scheduling: build_tile_order(), pop_tile() / steal_tiles(), tiled_conv2d()
+// 11. Thread pool backend: mpmc_push() / mpmc_pop(), thread_pool_start(), set_conv2d_executor(), run_tiles(), pool_conv2d()
+// 12. accumulate_conv2d()
+// 13. Sparse kernels: build_sparse_taps(), sparse_conv2d()
+// 14. Box kernels: is_box_kernel(), box_conv2d()
+// 15. Gaussian filtering: gaussian_iir_coefficients(), gaussian_iir_boundary(), gaussian_iir_band(), gaussian_filter()
+// 16. Layer-fused pipelines: parse_pipeline(), convolve_fused_tile(), pipeline_conv2d(), unfused_pipeline()
+// 17. Multi-kernel stencils: parse_stencil(), stencil_conv2d()
+// 18. Backward passes: conv2d_transpose(), weight_grad_tiles() / weight_grad_task(), conv2d_weight_grad()
+// 19. Reduced precision storage: float_to_half() / half_to_float(), convert_*(), half_conv2d()
+// 20. Quantization: prepare_quantization(), quantize_array() / dequantize_array(), quantized_conv2d()
+// 21. write_data_to_file()
+// 22. generate_data() / generate_rows()
+// 23. zero_data()
+// 24. reserve_buffer() / release_buffer() / report_page_size()
+// 25. NUMA helpers: read_numa_nodes(), pin_threads_to_nodes(), report_page_placement(), fork_conv2d()
+// 26. Instrumentation: profile_begin() / profile_end(), print_profile_summary(), write_profile_trace()
+// 27. Hardware counters: start_perf_counters() / stop_perf_counters(), print_perf_report()
+// 28. Verification: reference_conv2d(), default_verify_tolerance(), report_verification(), verify_outputs(), verify_stencil(), verify_gaussian(), flip_kernel(), verify_weight_grad()
+// 29. main()
 // ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ //
 
 
+#define _GNU_SOURCE     // For sched_setaffinity() and the CPU_SET macros
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
-#include <omp.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <signal.h>
+#include <sys/ioctl.h>
+#include <linux/perf_event.h>
+#include <math.h>
+#include <float.h>
+#include <complex.h>
+#include <stdatomic.h>
+#if defined(__F16C__) || defined(__AVX512BF16__) || defined(__AVX512VNNI__)
+#include <immintrin.h>
+#endif
+
+#include "conv2d.h"
 
 /* The string length of every float in the feature map. Example line: "0.594 0.934 0.212\n". 
 So, 3 floats, each looks like "X.XXX" which is 5 chars, but then all have a space or new-line 
 character. */
 #define FLOAT_STRING_LENGTH 6
 
-// Macros for max, min,
-#define max(a,b) (((a) > (b)) ? (a) : (b))
-#define min(a,b) (((a) < (b)) ? (a) : (b))
-
-// Macro for converting 2D indices to 1D index
-#define IDX(row, col, step) ((row) * (step) + (col))
-
-// A struct to hold a float array and its padding, to prevent false sharing.
-typedef struct {
-    float* arr;
-    char* padding;
-} float_array;
+// Where Linux describes the NUMA topology
+#define NUMA_SYSFS_PATH "/sys/devices/system/node"
 
 
 /*
@@ -50,6 +80,10 @@ int extract_dimensions(char* filepath, int* height, int* width) {
     if (filepath == NULL) { return 1; }
     char firstline[16];
 
+    // Binary files carry their dimensions in the header
+    int dtype;
+    if (read_binary_header(filepath, &dtype, height, width) == 0) { return 0; }
+
     FILE* file_ptr = fopen(filepath, "r");
     if (file_ptr == NULL){
         return 1;
@@ -84,6 +118,12 @@ int extract_dimensions(char* filepath, int* height, int* width) {
 int extract_data(char* filepath, int width, int height, int padding_width, int padding_height, float* *output) {
     
     if (filepath == NULL){ return 1; }
+
+    int dtype, file_height, file_width;
+    if (read_binary_header(filepath, &dtype, &file_height, &file_width) == 0){
+        return extract_binary_data(filepath, width, height, padding_width, padding_height, output);
+    }
+
     FILE* file_ptr = fopen(filepath, "r");
     if (file_ptr == NULL){ return 1; }
 
@@ -128,6 +168,288 @@ int extract_data(char* filepath, int width, int height, int padding_width, int p
 }
 
 
+/*
+* Reads the header of a binary file.
+* @param filepath     The filepath of the file.
+* @param dtype        Pointer to the location where the stored DTYPE_ will be stored.
+* @param height       Pointer to the location where the height will be stored.
+* @param width        Pointer to the location where the width will be stored.
+* @return             0 if the file is a valid binary file, otherwise 1 (e.g. for text files).
+*/
+int read_binary_header(char* filepath, int* dtype, int* height, int* width) {
+
+    if (filepath == NULL) { return 1; }
+    FILE* file_ptr = fopen(filepath, "rb");
+    if (file_ptr == NULL){ return 1; }
+
+    char magic[4];
+    int32_t fields[3];
+    const int valid = fread(magic, 1, 4, file_ptr) == 4 && memcmp(magic, BINARY_MAGIC, 4) == 0 &&
+        fread(fields, sizeof(int32_t), 3, file_ptr) == 3 && dtype_size(fields[0]) != 0 && fields[1] > 0 && fields[2] > 0;
+    fclose(file_ptr);
+
+    if (!valid) { return 1; }
+    *dtype = fields[0];
+    *height = fields[1];
+    *width = fields[2];
+    return 0;
+}
+
+
+/*
+* Checks whether outputs written to a filepath should use the binary format, i.e. whether it ends in ".bin".
+*/
+int is_binary_path(char* filepath) {
+    const size_t length = filepath == NULL ? 0 : strlen(filepath);
+    return length >= 4 && strcmp(filepath + length - 4, ".bin") == 0;
+}
+
+
+/* 
+* Reads a binary file into a padded float array, widening reduced precision data to float.
+* @param filepath         The filepath where the data is stored.
+* @param width            The number of elements in each row. Width.
+* @param height           The number of rows. Height.
+* @param padding_width    The number of zeroes the width is padded with.
+* @param padding_height   The number of zeroes the height is padded with.
+* @param output           The array into which the data will be stored.
+*/
+int extract_binary_data(char* filepath, int width, int height, int padding_width, int padding_height, float* *output) {
+
+    int dtype, file_height, file_width;
+    if (read_binary_header(filepath, &dtype, &file_height, &file_width) != 0 || file_width != width || file_height != height){
+        return 1;
+    }
+
+    FILE* file_ptr = fopen(filepath, "rb");
+    if (file_ptr == NULL){ return 1; }
+    fseek(file_ptr, BINARY_HEADER_SIZE, SEEK_SET);
+
+    const size_t element_size = dtype_size(dtype);
+    uint16_t* row_buffer = (uint16_t*)malloc((size_t)width * element_size);
+    if (row_buffer == NULL){ fclose(file_ptr); return 1; }
+
+    int status = 0;
+    for (int i = 0; i < height && status == 0; i++){
+        float* row = *output + IDX(i + padding_height, padding_width, width + 2 * padding_width);
+
+        // Float data goes straight into place; narrower data is widened after reading
+        if (dtype == DTYPE_FP32){
+            status = fread(row, sizeof(float), width, file_ptr) != (size_t)width;
+        } else {
+            status = fread(row_buffer, element_size, width, file_ptr) != (size_t)width;
+            convert_half_to_float(row_buffer, row, width, dtype);
+        }
+    }
+
+    free(row_buffer);
+    fclose(file_ptr);
+    return status;
+}
+
+
+/*
+Writes a (possibly padded) float array to a binary file, narrowing it to the given storage type.
+@param filepath         The filepath of the output file.
+@param data             The array to write.
+@param h_dimension      The height of the data, excluding padding.
+@param w_dimension      The width of the data, excluding padding.
+@param h_padding        The number of rows of padding above and below the data.
+@param w_padding        The number of columns of padding left and right of the data.
+@param dtype            The DTYPE_ to store the data as.
+*/
+int write_binary_file(char* filepath, float* data, int h_dimension, int w_dimension, int h_padding, int w_padding, int dtype){
+    if (filepath == NULL || data == NULL){ return 1; }
+    FILE* file_ptr = fopen(filepath, "wb");
+    if (file_ptr == NULL){ return 1; }
+
+    const int32_t fields[3] = { dtype, h_dimension, w_dimension };
+    fwrite(BINARY_MAGIC, 1, 4, file_ptr);
+    fwrite(fields, sizeof(int32_t), 3, file_ptr);
+
+    const size_t element_size = dtype_size(dtype);
+    uint16_t* row_buffer = (uint16_t*)malloc((size_t)w_dimension * element_size);
+    if (row_buffer == NULL){ fclose(file_ptr); return 1; }
+
+    int status = 0;
+    for (int i = 0; i < h_dimension && status == 0; i++){
+        float* row = data + IDX(i + h_padding, w_padding, w_dimension + 2 * w_padding);
+
+        if (dtype == DTYPE_FP32){
+            status = fwrite(row, sizeof(float), w_dimension, file_ptr) != (size_t)w_dimension;
+        } else {
+            convert_float_to_half(row, row_buffer, w_dimension, dtype);
+            status = fwrite(row_buffer, element_size, w_dimension, file_ptr) != (size_t)w_dimension;
+        }
+    }
+
+    free(row_buffer);
+    fclose(file_ptr);
+    return status;
+}
+
+
+// The epilogue applied by conv2d(), parallel_conv2d() and the tiled engines. Disabled by default.
+conv_epilogue conv2d_epilogue = { 0, 1.0f, 0.0f, EPILOGUE_NONE, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f };
+
+
+/*
+Parses an -epilogue list, such as "scale=0.5,bias=1,relu,quantize=int8:0.05". Whatever the order given,
+the operations are applied as scale, then bias, then the activation (at most one of relu, leaky, clamp,
+abs and square), then quantization.
+@param spec         The list. It's split in place.
+@param epilogue     The location where the parsed epilogue will be stored.
+@return             0 on success, or 1 with a message printed if the list is invalid.
+*/
+int parse_epilogue(char* spec, conv_epilogue* epilogue){
+
+    *epilogue = conv2d_epilogue;
+    epilogue->enabled = 1;
+    epilogue->scale = 1.0f;
+    epilogue->bias = 0.0f;
+    epilogue->activation = EPILOGUE_NONE;
+    epilogue->quant_step = 0.0f;
+
+    for (char* token = strtok(spec, ","); token != NULL; token = strtok(NULL, ",")){
+
+        char* value = strchr(token, '=');
+        if (value != NULL) { *value++ = '\0'; }
+
+        const int previous = epilogue->activation;
+        if (strcmp(token, "scale") == 0 && value != NULL){
+            epilogue->scale = (float)atof(value);
+        } else if (strcmp(token, "bias") == 0 && value != NULL){
+            epilogue->bias = (float)atof(value);
+        } else if (strcmp(token, "relu") == 0){
+            epilogue->activation = EPILOGUE_RELU;
+        } else if (strcmp(token, "leaky") == 0){
+            epilogue->activation = EPILOGUE_LEAKY;
+            epilogue->slope = value != NULL ? (float)atof(value) : 0.01f;
+        } else if (strcmp(token, "clamp") == 0 && value != NULL && sscanf(value, "%f:%f", &epilogue->low, &epilogue->high) == 2){
+            epilogue->activation = EPILOGUE_CLAMP;
+            if (epilogue->low > epilogue->high){
+                printf("Please provide -epilogue clamp as <low>:<high>, with low no greater than high.\n");
+                return 1;
+            }
+        } else if (strcmp(token, "abs") == 0){
+            epilogue->activation = EPILOGUE_ABS;
+        } else if (strcmp(token, "square") == 0){
+            epilogue->activation = EPILOGUE_SQUARE;
+        } else if (strcmp(token, "quantize") == 0 && value != NULL){
+            char* step = strchr(value, ':');
+            if (step != NULL) { *step++ = '\0'; }
+            const int type = parse_quant(value);
+            epilogue->quant_step = step != NULL ? (float)atof(step) : 0.0f;
+            if (type < 0 || epilogue->quant_step <= 0.0f){
+                printf("Please provide -epilogue quantize as int8:<step> or int16:<step>, with a positive step.\n");
+                return 1;
+            }
+            epilogue->quant_min = type == QUANT_INT8 ? -128.0f : -32768.0f;
+            epilogue->quant_max = type == QUANT_INT8 ? 127.0f : 32767.0f;
+        } else {
+            printf("Unknown -epilogue operation %s. Please provide bias=<v>, scale=<v>, relu, leaky[=<slope>], clamp=<low>:<high>, abs, square or quantize=<int8|int16>:<step>.\n", token);
+            return 1;
+        }
+
+        if (previous != EPILOGUE_NONE && epilogue->activation != previous){
+            printf("Please provide at most one of relu, leaky, clamp, abs and square in -epilogue.\n");
+            return 1;
+        }
+    }
+    return 0;
+}
+
+
+/*
+Sets the epilogue that conv2d(), parallel_conv2d(), tiled_conv2d() and pool_conv2d() apply to each output
+before storing it, or disables it.
+@param epilogue     The epilogue, or NULL for none.
+*/
+void set_conv2d_epilogue(const conv_epilogue* epilogue){
+    conv2d_epilogue.enabled = 0;
+    if (epilogue != NULL) { conv2d_epilogue = *epilogue; }
+}
+
+
+/*
+Applies an epilogue to one output, while it's still in a register.
+@param value        The convolution's result.
+@param e            The epilogue.
+*/
+float apply_epilogue(float value, const conv_epilogue* e){
+
+    value = value * e->scale + e->bias;
+
+    switch (e->activation){
+        case EPILOGUE_RELU: value = value > 0.0f ? value : 0.0f; break;
+        case EPILOGUE_LEAKY: value = value < 0.0f ? value * e->slope : value; break;
+        case EPILOGUE_CLAMP: value = value < e->low ? e->low : (value > e->high ? e->high : value); break;
+        case EPILOGUE_ABS: value = fabsf(value); break;
+        case EPILOGUE_SQUARE: value = value * value; break;
+    }
+
+    // Snap to the integer grid, so dividing by the step later gives the saturated codes exactly
+    if (e->quant_step > 0.0f){
+        const float code = rintf(value / e->quant_step);
+        value = (code < e->quant_min ? e->quant_min : (code > e->quant_max ? e->quant_max : code)) * e->quant_step;
+    }
+    return value;
+}
+
+
+/*
+Applies an epilogue to a run of outputs that's still in cache, for the engines that accumulate a row of
+outputs at a time. The loop has no dependencies, so it vectorises like the accumulation before it.
+@param values       The outputs.
+@param count        The number of outputs.
+@param e            The epilogue.
+*/
+void apply_epilogue_row(float* values, int count, const conv_epilogue* e){
+    #pragma omp simd
+    for (int k = 0; k < count; k++){
+        values[k] = apply_epilogue(values[k], e);
+    }
+}
+
+
+/*
+Applies an epilogue to the double precision reference, for -verify. Each output's sum of |terms| is carried
+through it too: scaled and biased like the output, then multiplied by the activation's steepest slope,
+since an error in the convolution grows by at most that much.
+@param reference    The reference outputs.
+@param magnitude    The sum of |terms| of each output.
+@param count        The number of outputs.
+@param e            The epilogue.
+@return             The absolute error to allow each output. A quantized output near the midpoint of two steps
+                    may round either way, so that's one step, plus the rounding of the largest code's value
+                    to float; otherwise 0.
+*/
+double apply_epilogue_reference(double* reference, double* magnitude, size_t count, const conv_epilogue* e){
+    for (size_t i = 0; i < count; i++){
+
+        double value = reference[i] * e->scale + e->bias;
+        double slope = 1.0;
+
+        switch (e->activation){
+            case EPILOGUE_RELU: value = max(value, 0.0); break;
+            case EPILOGUE_LEAKY: value = value < 0.0 ? value * e->slope : value; slope = max(1.0, fabs(e->slope)); break;
+            case EPILOGUE_CLAMP: value = min(max(value, (double)e->low), (double)e->high); break;
+            case EPILOGUE_ABS: value = fabs(value); break;
+            case EPILOGUE_SQUARE: slope = 2.0 * fabs(value); value = value * value; break;
+        }
+
+        if (e->quant_step > 0.0f){
+            const double code = rint(value / e->quant_step);
+            value = min(max(code, (double)e->quant_min), (double)e->quant_max) * e->quant_step;
+        }
+
+        reference[i] = value;
+        magnitude[i] = (magnitude[i] * fabs(e->scale) + fabs(e->bias)) * slope;
+    }
+    return e->quant_step * (1.0 + e->quant_max * FLT_EPSILON);
+}
+
+
 /* 
 * Performs serial 2D discrete convolutions. 
 * @param f             Pointer to the Feature Map.
@@ -145,6 +467,9 @@ int conv2d(float* f, int H, int W, float* g, int kH, int kW, int w_padding, int
     const int total_height = H + h_padding*2;
     const int total_width = W + w_padding*2;
 
+    // A local copy, so the compiler knows the output stores can't change it
+    const conv_epilogue epilogue = conv2d_epilogue;
+
     // dimensions for convolution window
     const int M = (kH - 1) / 2;
     const int N = (kW - 1) / 2;
@@ -161,6 +486,7 @@ int conv2d(float* f, int H, int W, float* g, int kH, int kW, int w_padding, int
                     result += f[IDX(n + i - M, k + j - N, total_width)] * g[IDX(i, j, kW)];
                 }
             }
+            if (epilogue.enabled) { result = apply_epilogue(result, &epilogue); }
             output[IDX(n - h_padding, k - w_padding, W)] = result;
         }
     }
@@ -185,91 +511,3835 @@ int parallel_conv2d(float* f, int H, int W, float* g, int kH, int kW, int w_padd
     const int total_height = H + h_padding*2;
     const int total_width = W + w_padding*2;
 
+    // A local copy, so the compiler knows the output stores can't change it
+    const conv_epilogue epilogue = conv2d_epilogue;
+
     // dimensions for convolution window
     const int M = (kH - 1) / 2;
     const int N = (kW - 1) / 2;
 
-    #pragma omp parallel for collapse(2) schedule(dynamic, total_width)
-    for (int n = h_padding; n < total_height - h_padding; n++){
-        for (int k = w_padding; k < total_width - w_padding; k++){
-            float result = 0.0f;
+    #pragma omp parallel
+    {
+        // Timed per thread, without the closing barrier, so any load imbalance shows up in the profile
+        const double thread_start = profile_begin();
+
+        // Static row partition, matching the one used by generate_data() and zero_data() for first-touch
+        #pragma omp for schedule(static) nowait
+        for (int n = h_padding; n < total_height - h_padding; n++){
+            for (int k = w_padding; k < total_width - w_padding; k++){
+                float result = 0.0f;
+
+                #pragma omp simd collapse(2) reduction(+:result)
+                for (int j = 0; j < kW; j++){
+                    for (int i = 0; i < kH; i++){
+                        result += f[IDX(n + i - M, k + j - N, total_width)] * g[IDX(i, j, kW)];
+                    }
+                }
+                if (epilogue.enabled) { result = apply_epilogue(result, &epilogue); }
+                padded_output.arr[IDX(n - h_padding, k - w_padding, W)] = result;
+            }
+        }
 
-            #pragma omp simd collapse(2) reduction(+:result)
+        profile_end("parallel_conv2d/thread", thread_start);
+    }
+    return 0;
+}
+
+
+/* 
+* Performs 2D discrete convolutions whose results are bit-identical for any number of threads, any SIMD
+* width and any machine. Every output accumulates its taps in the same order as conv2d(), each with one
+* explicit fmaf(), which is correctly rounded whether or not the CPU has FMA instructions. Vectorisation
+* runs across neighbouring outputs rather than across taps, so it never changes the order of a sum.
+* @param f             Pointer to the Feature Map.
+* @param H             Height of the Feature Map.
+* @param W             Width of the Feature Map.
+* @param g             Pointer to the Kernel.
+* @param kH            Height of the Kernel.
+* @param kW            Width of the Kernel.
+* @param w_padding     Width of the padding in the Feature Map.
+* @param h_padding     Height of the padding in the Feature Map.
+* @param output        Pointer to the location where outputs are stored.
+*/
+int deterministic_conv2d(float* f, int H, int W, float* g, int kH, int kW, int w_padding, int h_padding, float* output){
+
+    const int total_width = W + w_padding*2;
+
+    // dimensions for convolution window
+    const int M = (kH - 1) / 2;
+    const int N = (kW - 1) / 2;
+
+    #pragma omp parallel for schedule(static)
+    for (int n = h_padding; n < H + h_padding; n++){
+
+        // Blocks of columns keep the partial sums in L1 while every tap is applied to them
+        for (int block = 0; block < W; block += DETERMINISTIC_BLOCK){
+
+            const int block_width = min(DETERMINISTIC_BLOCK, W - block);
+            float* out = output + IDX(n - h_padding, block, W);
+
+            for (int k = 0; k < block_width; k++){
+                out[k] = 0.0f;
+            }
+
+            // Same tap order as conv2d(): columns of the kernel outside, rows inside
             for (int j = 0; j < kW; j++){
                 for (int i = 0; i < kH; i++){
-                    result += f[IDX(n + i - M, k + j - N, total_width)] * g[IDX(i, j, kW)];
+                    const float weight = g[IDX(i, j, kW)];
+                    const float* in = f + IDX(n + i - M, block + w_padding + j - N, total_width);
+
+                    #pragma omp simd
+                    for (int k = 0; k < block_width; k++){
+                        out[k] = fmaf(in[k], weight, out[k]);
+                    }
                 }
             }
-            padded_output.arr[IDX(n - h_padding, k - w_padding, W)] = result;
         }
     }
     return 0;
 }
 
 
+/* 
+* Performs parallel 2D discrete convolutions by streaming each input row through L1 once. Each input row
+* contributes to kH output rows, one per kernel row, so a rolling buffer keeps the partial sums of the kH
+* output rows the window currently covers. An input row is applied to all of them while it's in L1, then
+* the oldest output row is complete, written out, and its slot reused for the next one.
+* Every input is read from memory once per column block rather than kH times, which helps most for tall
+* and wide kernels, where the other engines re-read each input row for every output row.
+* @param f             Pointer to the Feature Map.
+* @param H             Height of the Feature Map.
+* @param W             Width of the Feature Map.
+* @param g             Pointer to the Kernel.
+* @param kH            Height of the Kernel.
+* @param kW            Width of the Kernel.
+* @param w_padding     Width of the padding in the Feature Map.
+* @param h_padding     Height of the padding in the Feature Map.
+* @param output        Pointer to the location where outputs are stored.
+*/
+int sliding_conv2d(float* f, int H, int W, float* g, int kH, int kW, int w_padding, int h_padding, float* output){
+
+    const int total_width = W + w_padding*2;
+
+    // dimensions for convolution window
+    const int M = (kH - 1) / 2;
+    const int N = (kW - 1) / 2;
+
+    int failed = 0;
+
+    #pragma omp parallel reduction(|:failed)
+    {
+        float* partial = NULL;
+        failed = posix_memalign((void**)&partial, 64, (size_t)kH * SLIDING_BLOCK * sizeof(float)) != 0;
+
+        // The same static row partition as the other engines, so first-touch placement still applies
+        const int thread = omp_get_thread_num();
+        const int thread_count = omp_get_num_threads();
+        const int first = h_padding + (int)((long long)H * thread / thread_count);
+        const int last = h_padding + (int)((long long)H * (thread + 1) / thread_count);
+
+        for (int block = 0; block < W && first < last && !failed; block += SLIDING_BLOCK){
+
+            const int block_width = min(SLIDING_BLOCK, W - block);
+
+            // Output row n lives in slot n % kH until it's complete
+            for (int k = 0; k < kH * SLIDING_BLOCK; k++) { partial[k] = 0.0f; }
+
+            // Every input row under the band's windows, top to bottom
+            for (int r = first - M; r < last - M + kH - 1; r++){
+
+                const float* in = f + IDX(r, block + w_padding - N, total_width);
+
+                // Kernel row i applies this input row to output row r - i + M
+                for (int i = max(0, r + M - last + 1); i < kH && r - i + M >= first; i++){
+                    float* sum = partial + (size_t)((r - i + M) % kH) * SLIDING_BLOCK;
+
+                    for (int j = 0; j < kW; j++){
+                        const float weight = g[IDX(i, j, kW)];
+
+                        #pragma omp simd
+                        for (int k = 0; k < block_width; k++){
+                            sum[k] += in[k + j] * weight;
+                        }
+                    }
+                }
+
+                // The output row whose window ends here is complete
+                const int n = r - kH + 1 + M;
+                if (n >= first){
+                    float* sum = partial + (size_t)(n % kH) * SLIDING_BLOCK;
+                    float* out = output + IDX(n - h_padding, block, W);
+                    for (int k = 0; k < block_width; k++){
+                        out[k] = sum[k];
+                        sum[k] = 0.0f;
+                    }
+                }
+            }
+        }
+
+        free(partial);
+    }
+    return failed;
+}
+
+
 /*
-Writes outputs to a file.
-@param filepath         The filepath of where to find/put the output file.
-@param outputs          A 2d array of float32s. This is what is written to the file for serial convolutions.
-@param padded_outputs   A padded 2d array of float32s. This is written to the file, instead of `outputs`, when outputting data from a parallel convolution.
-@param h_dimension      The height of the outputs. Should be the same as the feature map.
-@param w_dimension      The width of the outputs. Should be the same as the feature map.
+The position of (x, y) along a Hilbert curve filling a side x side square, where side is a power of two.
+Consecutive positions are always neighbouring cells.
 */
-int write_data_to_file(char* filepath, float* outputs, float_array padded_outputs, int h_dimension, int w_dimension, int h_padding, int w_padding){
-    if (filepath == NULL){ return 1; }
-    FILE* file_ptr = fopen(filepath, "w");
-    if (file_ptr == NULL){ return 1; }
+long long hilbert_index(int side, int x, int y){
+    long long d = 0;
+    for (int s = side / 2; s > 0; s /= 2){
+        const int rx = (x & s) > 0;
+        const int ry = (y & s) > 0;
+        d += (long long)s * s * ((3 * rx) ^ ry);
 
-    // Empty the file, then close it.
-    fclose(file_ptr);
+        // Rotate the quadrant so the curve inside it starts and ends in the right corners
+        if (ry == 0){
+            if (rx == 1){
+                x = s - 1 - x;
+                y = s - 1 - y;
+            }
+            const int t = x; x = y; y = t;
+        }
+    }
+    return d;
+}
 
-    // Reopen file in append mode
-    file_ptr = fopen(filepath, "a");
 
-    // Append the dimensions to the file
-    fprintf(file_ptr, "%d %d\n", h_dimension, w_dimension);
-    
-    for (int i = h_padding; i < h_dimension + h_padding; i++){
-        for (int j = w_padding; j < w_dimension + w_padding; j++){
+// Orders tiles by their Hilbert index, for qsort()
+int compare_tiles(const void* a, const void* b){
+    const long long da = ((const conv_tile*)a)->order;
+    const long long db = ((const conv_tile*)b)->order;
+    return (da > db) - (da < db);
+}
+
+
+/*
+Builds the list of output tiles for an H x W output, ordered along a Hilbert curve so that consecutive
+tiles, which usually run on the same thread, share their input halos in cache.
+@param H            Height of the output.
+@param W            Width of the output.
+@param tiles        The location where the tile list will be stored. Free it with free().
+@return             The number of tiles, or -1 if the list couldn't be allocated.
+*/
+int build_tile_order(int H, int W, conv_tile* *tiles){
+
+    const int tile_rows = (H + TILE_HEIGHT - 1) / TILE_HEIGHT;
+    const int tile_columns = (W + TILE_WIDTH - 1) / TILE_WIDTH;
+    const int count = tile_rows * tile_columns;
+
+    int side = 1;
+    while (side < max(tile_rows, tile_columns)) { side *= 2; }
+
+    *tiles = (conv_tile*)malloc((size_t)count * sizeof(conv_tile));
+    if (*tiles == NULL) { return -1; }
+
+    for (int i = 0; i < tile_rows; i++){
+        for (int j = 0; j < tile_columns; j++){
+            conv_tile* tile = &(*tiles)[IDX(i, j, tile_columns)];
+            tile->row = i * TILE_HEIGHT;
+            tile->column = j * TILE_WIDTH;
+            tile->order = hilbert_index(side, j, i);
+        }
+    }
+    qsort(*tiles, count, sizeof(conv_tile), compare_tiles);
+    return count;
+}
+
+
+/*
+Takes the next tile from the front of a thread's own deque.
+@return     The tile's position in the tile list, or -1 if the deque is empty.
+*/
+int pop_tile(tile_deque* deque){
+    uint64_t range = atomic_load(&deque->range);
+    while (1){
+        const uint32_t head = (uint32_t)(range >> 32), tail = (uint32_t)range;
+        if (head >= tail) { return -1; }
+        if (atomic_compare_exchange_weak(&deque->range, &range, ((uint64_t)(head + 1) << 32) | tail)) { return (int)head; }
+    }
+}
+
+
+/*
+Steals the back half of another thread's remaining tiles into an empty deque of our own. Taking a
+contiguous run from the back keeps the thief's tiles neighbours along the curve, away from the victim's.
+@return     1 if any tiles were stolen, or 0 if the victim had none left.
+*/
+int steal_tiles(tile_deque* victim, tile_deque* own){
+    uint64_t range = atomic_load(&victim->range);
+    while (1){
+        const uint32_t head = (uint32_t)(range >> 32), tail = (uint32_t)range;
+        if (head >= tail) { return 0; }
+
+        const uint32_t split = tail - (tail - head + 1) / 2;
+        if (atomic_compare_exchange_weak(&victim->range, &range, ((uint64_t)head << 32) | split)){
+            // Nobody else writes to an empty deque, so its owner can refill it directly
+            atomic_store(&own->range, ((uint64_t)split << 32) | tail);
+            return 1;
+        }
+    }
+}
+
+
+/*
+Computes the outputs of one tile, a row at a time, vectorised across the tile's columns. The parameters
+are those of the convolution engines, plus the tile to compute.
+*/
+void convolve_tile(float* f, int H, int W, float* g, int kH, int kW, int w_padding, int h_padding, float* output, conv_tile tile){
+
+    const int total_width = W + w_padding*2;
+    const conv_epilogue epilogue = conv2d_epilogue;
+
+    // dimensions for convolution window
+    const int M = (kH - 1) / 2;
+    const int N = (kW - 1) / 2;
+
+    const int rows = min(TILE_HEIGHT, H - tile.row);
+    const int columns = min(TILE_WIDTH, W - tile.column);
+
+    for (int n = tile.row; n < tile.row + rows; n++){
+        float* out = output + IDX(n, tile.column, W);
+        for (int k = 0; k < columns; k++) { out[k] = 0.0f; }
+
+        for (int i = 0; i < kH; i++){
+            const float* in = f + IDX(n + h_padding + i - M, tile.column + w_padding - N, total_width);
+            for (int j = 0; j < kW; j++){
+                const float weight = g[IDX(i, j, kW)];
+
+                #pragma omp simd
+                for (int k = 0; k < columns; k++){
+                    out[k] += in[k + j] * weight;
+                }
+            }
+        }
+
+        // The row is still in L1
+        if (epilogue.enabled) { apply_epilogue_row(out, columns, &epilogue); }
+    }
+}
+
+
+/* 
+* Performs parallel 2D discrete convolutions over 2D output tiles, with work stealing. The tiles are
+* ordered along a Hilbert curve and split into one contiguous run per thread, which each thread works
+* through from the front. A thread that runs out steals the back half of another thread's remaining run,
+* so slower cores (E-cores, or cores shared with other jobs) give up work instead of holding up the rest.
+* The scheduling lives in run_tiles(), which runs convolve_tile() on each tile.
+* @param f             Pointer to the Feature Map.
+* @param H             Height of the Feature Map.
+* @param W             Width of the Feature Map.
+* @param g             Pointer to the Kernel.
+* @param kH            Height of the Kernel.
+* @param kW            Width of the Kernel.
+* @param w_padding     Width of the padding in the Feature Map.
+* @param h_padding     Height of the padding in the Feature Map.
+* @param output        Pointer to the location where outputs are stored.
+*/
+int tiled_conv2d(float* f, int H, int W, float* g, int kH, int kW, int w_padding, int h_padding, float* output){
+    return run_tiles(convolve_tile, f, H, W, g, kH, kW, w_padding, h_padding, output, 0);
+}
+
+
+/*
+Initialises a bounded multi-producer, multi-consumer queue of task numbers (Vyukov's design). Each cell
+carries a sequence number that says whether it's ready to be written or read at a given position, so
+producers and consumers only ever contend on one compare-and-swap of their own position counter.
+@param queue        The queue to initialise.
+@param capacity     The number of cells. Must be a power of two.
+*/
+int mpmc_init(mpmc_queue* queue, size_t capacity){
+    if (posix_memalign((void**)&queue->cells, 64, capacity * sizeof(mpmc_cell)) != 0) { return 1; }
+    for (size_t i = 0; i < capacity; i++) { atomic_init(&queue->cells[i].sequence, i); }
+    queue->mask = capacity - 1;
+    atomic_init(&queue->enqueue_position, 0);
+    atomic_init(&queue->dequeue_position, 0);
+    return 0;
+}
+
+
+/*
+Adds a task number to the queue.
+@return     0 on success, or 1 if the queue is full.
+*/
+int mpmc_push(mpmc_queue* queue, int value){
+    size_t position = atomic_load_explicit(&queue->enqueue_position, memory_order_relaxed);
+    while (1){
+        mpmc_cell* cell = &queue->cells[position & queue->mask];
+        const size_t sequence = atomic_load_explicit(&cell->sequence, memory_order_acquire);
+        const ptrdiff_t difference = (ptrdiff_t)sequence - (ptrdiff_t)position;
+
+        if (difference == 0){
+            // The cell is free at this position; claim the position
+            if (atomic_compare_exchange_weak_explicit(&queue->enqueue_position, &position, position + 1, memory_order_relaxed, memory_order_relaxed)){
+                cell->value = value;
+                atomic_store_explicit(&cell->sequence, position + 1, memory_order_release);
+                return 0;
+            }
+        } else if (difference < 0){
+            return 1;   // Still holds a value from a lap ago
+        } else {
+            position = atomic_load_explicit(&queue->enqueue_position, memory_order_relaxed);
+        }
+    }
+}
+
+
+/*
+Takes a task number from the queue.
+@return     The task number, or -1 if the queue is empty.
+*/
+int mpmc_pop(mpmc_queue* queue){
+    size_t position = atomic_load_explicit(&queue->dequeue_position, memory_order_relaxed);
+    while (1){
+        mpmc_cell* cell = &queue->cells[position & queue->mask];
+        const size_t sequence = atomic_load_explicit(&cell->sequence, memory_order_acquire);
+        const ptrdiff_t difference = (ptrdiff_t)sequence - (ptrdiff_t)(position + 1);
+
+        if (difference == 0){
+            if (atomic_compare_exchange_weak_explicit(&queue->dequeue_position, &position, position + 1, memory_order_relaxed, memory_order_relaxed)){
+                const int value = cell->value;
+                // Free the cell for the producer one lap ahead
+                atomic_store_explicit(&cell->sequence, position + queue->mask + 1, memory_order_release);
+                return value;
+            }
+        } else if (difference < 0){
+            return -1;
+        } else {
+            position = atomic_load_explicit(&queue->dequeue_position, memory_order_relaxed);
+        }
+    }
+}
+
+
+// The built-in pool, and the executor used instead of it, if one has been set
+thread_pool pool = { .lock = PTHREAD_MUTEX_INITIALIZER, .work = PTHREAD_COND_INITIALIZER, .done = PTHREAD_COND_INITIALIZER };
+conv2d_executor external_executor = NULL;
+void* external_context = NULL;
+
+
+/*
+Runs queued tasks of the pool's current job until every task has been queued and the queue is empty,
+waking the submitter when the last task of the job finishes. While the submitter is still feeding in a
+job larger than the queue, an empty queue only means the next tasks haven't arrived yet.
+*/
+void drain_pool_queue(){
+    while (1){
+        const int task = mpmc_pop(&pool.queue);
+        if (task < 0){
+            if (atomic_load(&pool.unqueued) == 0) { return; }
+            sched_yield();
+            continue;
+        }
+        pool.run(pool.job, task);
+        if (atomic_fetch_sub(&pool.pending, 1) == 1){
+            pthread_mutex_lock(&pool.lock);
+            pthread_cond_signal(&pool.done);
+            pthread_mutex_unlock(&pool.lock);
+        }
+    }
+}
+
+
+// Each pool thread sleeps until a new job is published, then helps drain the queue
+void* pool_worker(void* unused){
+    (void)unused;
+    long long seen = 0;
+    while (1){
+        pthread_mutex_lock(&pool.lock);
+        while (pool.generation == seen && !pool.stopping) { pthread_cond_wait(&pool.work, &pool.lock); }
+        seen = pool.generation;
+        const int stopping = pool.stopping;
+        pthread_mutex_unlock(&pool.lock);
+
+        if (stopping) { return NULL; }
+        drain_pool_queue();
+    }
+}
+
+
+/*
+Starts the built-in pool with the given number of threads, including the thread that submits jobs, so
+threads - 1 workers are created. Does nothing if the pool is already that size; otherwise restarts it.
+*/
+int thread_pool_start(int threads){
+
+    threads = max(threads, 1);
+    if (pool.running && pool.thread_count == threads) { return 0; }
+    thread_pool_stop();
+
+    if (pool.queue.cells == NULL && mpmc_init(&pool.queue, POOL_QUEUE_CAPACITY) != 0) { return 1; }
+    pool.workers = (pthread_t*)malloc(threads * sizeof(pthread_t));
+    if (pool.workers == NULL) { return 1; }
+
+    pool.stopping = 0;
+    pool.thread_count = threads;
+    for (int t = 0; t < threads - 1; t++){
+        if (pthread_create(&pool.workers[t], NULL, pool_worker, NULL) != 0){
+            pool.thread_count = t + 1;
+            thread_pool_stop();
+            return 1;
+        }
+    }
+    pool.running = 1;
+    return 0;
+}
+
+
+/*
+Stops and joins the built-in pool's threads. Safe to call when the pool isn't running.
+*/
+void thread_pool_stop(){
+    if (pool.workers == NULL) { return; }
+
+    pthread_mutex_lock(&pool.lock);
+    pool.stopping = 1;
+    pthread_cond_broadcast(&pool.work);
+    pthread_mutex_unlock(&pool.lock);
+
+    for (int t = 0; t < pool.thread_count - 1; t++) { pthread_join(pool.workers[t], NULL); }
+    free(pool.workers);
+    pool.workers = NULL;
+    pool.running = 0;
+}
+
+
+/*
+The built-in executor: queues every task, wakes the pool, and helps run them. The first queue-full of
+tasks is pushed before the workers are woken, so none of them finds the queue empty and goes back to
+sleep. A job larger than the queue is fed in as space frees up, with the submitter running tasks whenever
+the queue is full. Only one job runs at a time.
+*/
+void pool_execute(void* context, conv2d_task run, void* job, int task_count){
+    (void)context;
+
+    pool.run = run;
+    pool.job = job;
+    atomic_store(&pool.pending, task_count);
+    atomic_store(&pool.unqueued, task_count);
+
+    int task = 0;
+    while (task < task_count && mpmc_push(&pool.queue, task) == 0){
+        task++;
+        atomic_fetch_sub(&pool.unqueued, 1);
+    }
+
+    pthread_mutex_lock(&pool.lock);
+    pool.generation++;
+    pthread_cond_broadcast(&pool.work);
+    pthread_mutex_unlock(&pool.lock);
+
+    for (; task < task_count; task++){
+        while (mpmc_push(&pool.queue, task) != 0){
+            const int queued = mpmc_pop(&pool.queue);
+            if (queued < 0) { continue; }
+            run(job, queued);
+            atomic_fetch_sub(&pool.pending, 1);
+        }
+        atomic_fetch_sub(&pool.unqueued, 1);
+    }
+    drain_pool_queue();
+
+    pthread_mutex_lock(&pool.lock);
+    while (atomic_load(&pool.pending) > 0) { pthread_cond_wait(&pool.done, &pool.lock); }
+    pthread_mutex_unlock(&pool.lock);
+}
+
+
+/*
+Hands pool_conv2d()'s tasks to the host's own thread pool instead of the built-in one.
+@param executor     Called once per convolution; must run run(job, t) for every t in [0, task_count),
+                    on any threads and in any order, and return once they've all finished. NULL restores
+                    the built-in pool.
+@param context      Passed back to the executor.
+*/
+void set_conv2d_executor(conv2d_executor executor, void* context){
+    external_executor = executor;
+    external_context = context;
+}
+
+
+// Runs one tile of a run_tiles() job
+void tile_job_task(void* job, int task){
+    tile_job* j = (tile_job*)job;
+    j->run_tile(j->f, j->H, j->W, j->g, j->kH, j->kW, j->w_padding, j->h_padding, j->output, j->tiles[task]);
+}
+
+
+/*
+Runs a tile function over every Hilbert-ordered tile of an H x W output, either on OpenMP threads with
+work stealing, or as one task per tile on the built-in pool or the executor from set_conv2d_executor().
+With work stealing, the tiles are split into one contiguous run per thread, which each thread works
+through from the front. A thread that runs out steals the back half of another thread's remaining run.
+The other parameters are those of the convolution engines, and are passed on to every tile.
+@param run_tile     Computes one tile, such as convolve_tile().
+@param on_pool      1 to run on the pool or executor, or 0 for OpenMP threads.
+@return             0 on success, or 1 if the tiles or the pool couldn't be set up.
+*/
+int run_tiles(conv_tile_function run_tile, float* f, int H, int W, float* g, int kH, int kW, int w_padding, int h_padding, float* output, int on_pool){
+
+    tile_job job = { run_tile, f, H, W, g, kH, kW, w_padding, h_padding, output, NULL };
+    const int tile_count = build_tile_order(H, W, &job.tiles);
+    if (tile_count < 0) { return 1; }
+
+    if (on_pool){
+        if (external_executor != NULL){
+            external_executor(external_context, tile_job_task, &job, tile_count);
+        } else {
+            if (!pool.running && thread_pool_start(omp_get_max_threads()) != 0){
+                free(job.tiles);
+                return 1;
+            }
+            pool_execute(NULL, tile_job_task, &job, tile_count);
+        }
+        free(job.tiles);
+        return 0;
+    }
+
+    const int thread_count = omp_get_max_threads();
+    tile_deque* deques = NULL;
+    if (posix_memalign((void**)&deques, 64, thread_count * sizeof(tile_deque)) != 0){
+        free(job.tiles);
+        return 1;
+    }
+
+    #pragma omp parallel num_threads(thread_count)
+    {
+        const int thread = omp_get_thread_num();
+        const int threads = omp_get_num_threads();
+
+        const uint32_t head = (uint32_t)((long long)tile_count * thread / threads);
+        const uint32_t tail = (uint32_t)((long long)tile_count * (thread + 1) / threads);
+        atomic_init(&deques[thread].range, ((uint64_t)head << 32) | tail);
+
+        #pragma omp barrier
+
+        const double thread_start = profile_begin();
+
+        while (1){
+            int next = pop_tile(&deques[thread]);
+
+            // Out of work: try every other thread, nearest first
+            for (int v = 1; next < 0 && v < threads; v++){
+                if (steal_tiles(&deques[(thread + v) % threads], &deques[thread])) { next = pop_tile(&deques[thread]); }
+            }
+            if (next < 0) { break; }
+
+            tile_job_task(&job, next);
+        }
+
+        profile_end("run_tiles/thread", thread_start);
+    }
+
+    free(deques);
+    free(job.tiles);
+    return 0;
+}
+
+
+/* 
+* Performs parallel 2D discrete convolutions on a pthreads pool, or on an executor supplied with
+* set_conv2d_executor(), without OpenMP. The output is split into the same Hilbert-ordered tiles as
+* tiled_conv2d(), and each tile is one task.
+* @param f             Pointer to the Feature Map.
+* @param H             Height of the Feature Map.
+* @param W             Width of the Feature Map.
+* @param g             Pointer to the Kernel.
+* @param kH            Height of the Kernel.
+* @param kW            Width of the Kernel.
+* @param w_padding     Width of the padding in the Feature Map.
+* @param h_padding     Height of the padding in the Feature Map.
+* @param output        Pointer to the location where outputs are stored.
+*/
+int pool_conv2d(float* f, int H, int W, float* g, int kH, int kW, int w_padding, int h_padding, float* output){
+    return run_tiles(convolve_tile, f, H, W, g, kH, kW, w_padding, h_padding, output, 1);
+}
+
+
+#ifndef _OPENMP
+// Without OpenMP, the OpenMP runtime calls are single-threaded stand-ins; only pool_conv2d() runs in parallel.
+// omp_set_num_threads() is still tracked, as it sizes the pool that the pool fallbacks start.
+int max_threads_setting = 0;                    // 0 until omp_set_num_threads(), meaning one per processor
+
+double omp_get_wtime(){
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec * 1e-9;
+}
+int omp_get_thread_num() { return 0; }
+int omp_get_num_threads() { return 1; }
+int omp_get_max_threads() { return max_threads_setting > 0 ? max_threads_setting : omp_get_num_procs(); }
+int omp_get_num_procs() { return (int)sysconf(_SC_NPROCESSORS_ONLN); }
+void omp_set_num_threads(int threads) { max_threads_setting = max(threads, 1); }
+#endif
+
+
+/*
+Parses an -accumulate name.
+@return     The ACCUMULATE_ policy for the name, or -1 if it isn't recognised.
+*/
+int parse_accumulator(const char* name){
+    if (strcmp(name, "fp32") == 0) { return ACCUMULATE_FP32; }
+    if (strcmp(name, "fp64") == 0) { return ACCUMULATE_FP64; }
+    if (strcmp(name, "pairwise") == 0) { return ACCUMULATE_PAIRWISE; }
+    if (strcmp(name, "kahan") == 0) { return ACCUMULATE_KAHAN; }
+    return -1;
+}
+
+
+/* 
+* Performs parallel 2D discrete convolutions with a choice of accumulator, trading speed for precision.
+* Like deterministic_conv2d(), every output sums its taps in conv2d()'s order, and vectorisation runs
+* across a block of neighbouring outputs, so each policy's accumulators are plain arrays the compiler
+* can keep in vector registers:
+*   ACCUMULATE_FP32       One float per output. Error grows with the number of taps.
+*   ACCUMULATE_FP64       One double per output. The float products are exact in double, so only the
+*                         double additions round; about half the float throughput.
+*   ACCUMULATE_PAIRWISE   Float sums of PAIRWISE_CHUNK taps, combined in a binary tree, so error grows
+*                         with the log of the number of taps. Costs little over fp32.
+*   ACCUMULATE_KAHAN      Float sums with a running compensation for the bits each addition loses,
+*                         giving error independent of the number of taps. Four float operations per tap.
+* @param f             Pointer to the Feature Map.
+* @param H             Height of the Feature Map.
+* @param W             Width of the Feature Map.
+* @param g             Pointer to the Kernel.
+* @param kH            Height of the Kernel.
+* @param kW            Width of the Kernel.
+* @param w_padding     Width of the padding in the Feature Map.
+* @param h_padding     Height of the padding in the Feature Map.
+* @param output        Pointer to the location where outputs are stored.
+* @param policy        One of the ACCUMULATE_ policies.
+*/
+int accumulate_conv2d(float* f, int H, int W, float* g, int kH, int kW, int w_padding, int h_padding, float* output, int policy){
+
+    const int total_width = W + w_padding*2;
+
+    // dimensions for convolution window
+    const int M = (kH - 1) / 2;
+    const int N = (kW - 1) / 2;
+
+    // The pairwise tree needs one level per bit of the number of chunks
+    const int chunks = (kH * kW + PAIRWISE_CHUNK - 1) / PAIRWISE_CHUNK;
+    int levels = 1;
+    while ((1 << levels) <= chunks) { levels++; }
+
+    int failed = 0;
+
+    #pragma omp parallel reduction(|:failed)
+    {
+        // Per-thread scratch, in bytes: the largest of what any policy needs for one block
+        const size_t scratch_size = ACCUMULATE_BLOCK * max(sizeof(double), sizeof(float) * (levels + 1));
+        char* scratch = NULL;
+        failed = posix_memalign((void**)&scratch, 64, scratch_size) != 0;
+
+        #pragma omp for schedule(static)
+        for (int n = h_padding; n < H + h_padding; n++){
+            for (int block = 0; block < W && !failed; block += ACCUMULATE_BLOCK){
+
+                const int block_width = min(ACCUMULATE_BLOCK, W - block);
+                float* out = output + IDX(n - h_padding, block, W);
+                const float* origin = f + IDX(n - M, block + w_padding - N, total_width);
+
+                if (policy == ACCUMULATE_FP64){
+                    double* sum = (double*)scratch;
+                    for (int k = 0; k < block_width; k++) { sum[k] = 0.0; }
+
+                    for (int j = 0; j < kW; j++){
+                        for (int i = 0; i < kH; i++){
+                            const double weight = g[IDX(i, j, kW)];
+                            const float* in = origin + IDX(i, j, total_width);
+
+                            #pragma omp simd
+                            for (int k = 0; k < block_width; k++){
+                                sum[k] += (double)in[k] * weight;
+                            }
+                        }
+                    }
+                    for (int k = 0; k < block_width; k++) { out[k] = (float)sum[k]; }
+
+                } else if (policy == ACCUMULATE_KAHAN){
+                    float* compensation = (float*)scratch;
+                    for (int k = 0; k < block_width; k++) { out[k] = 0.0f; compensation[k] = 0.0f; }
+
+                    for (int j = 0; j < kW; j++){
+                        for (int i = 0; i < kH; i++){
+                            const float weight = g[IDX(i, j, kW)];
+                            const float* in = origin + IDX(i, j, total_width);
+
+                            #pragma omp simd
+                            for (int k = 0; k < block_width; k++){
+                                const float corrected = in[k] * weight - compensation[k];
+                                const float total = out[k] + corrected;
+                                compensation[k] = (total - out[k]) - corrected;
+                                out[k] = total;
+                            }
+                        }
+                    }
+
+                } else if (policy == ACCUMULATE_PAIRWISE){
+                    // chunk holds the running sum of the current PAIRWISE_CHUNK taps. Finished chunks are merged
+                    // like a binary counter: level l holds the sum of 2^l chunks, and equal levels are added
+                    // together before being carried upwards.
+                    float* chunk = (float*)scratch;
+                    float* tree = chunk + ACCUMULATE_BLOCK;
+                    for (int k = 0; k < block_width; k++) { chunk[k] = 0.0f; }
+
+                    int tap = 0, finished = 0;
+                    for (int j = 0; j < kW; j++){
+                        for (int i = 0; i < kH; i++){
+                            const float weight = g[IDX(i, j, kW)];
+                            const float* in = origin + IDX(i, j, total_width);
+
+                            #pragma omp simd
+                            for (int k = 0; k < block_width; k++){
+                                chunk[k] += in[k] * weight;
+                            }
+
+                            if (++tap % PAIRWISE_CHUNK != 0) { continue; }
+
+                            int level = 0;
+                            for (int carry = finished; carry & 1; carry >>= 1, level++){
+                                float* partial = tree + level * ACCUMULATE_BLOCK;
+                                #pragma omp simd
+                                for (int k = 0; k < block_width; k++) { chunk[k] += partial[k]; }
+                            }
+                            float* partial = tree + level * ACCUMULATE_BLOCK;
+                            for (int k = 0; k < block_width; k++) { partial[k] = chunk[k]; chunk[k] = 0.0f; }
+                            finished++;
+                        }
+                    }
+
+                    // Add the unfinished chunk and every occupied level, smallest first
+                    for (int level = 0; (finished >> level) != 0; level++){
+                        if (((finished >> level) & 1) == 0) { continue; }
+                        float* partial = tree + level * ACCUMULATE_BLOCK;
+                        #pragma omp simd
+                        for (int k = 0; k < block_width; k++) { chunk[k] += partial[k]; }
+                    }
+                    for (int k = 0; k < block_width; k++) { out[k] = chunk[k]; }
+
+                } else {
+                    for (int k = 0; k < block_width; k++) { out[k] = 0.0f; }
+
+                    for (int j = 0; j < kW; j++){
+                        for (int i = 0; i < kH; i++){
+                            const float weight = g[IDX(i, j, kW)];
+                            const float* in = origin + IDX(i, j, total_width);
+
+                            #pragma omp simd
+                            for (int k = 0; k < block_width; k++){
+                                out[k] += in[k] * weight;
+                            }
+                        }
+                    }
+                }
+            }
+        }
+
+        free(scratch);
+    }
+    return failed;
+}
+
+
+/*
+Builds the list of a kernel's nonzero taps, in the same order conv2d() applies them.
+@param g            Pointer to the Kernel.
+@param kH           Height of the Kernel.
+@param kW           Width of the Kernel.
+@param total_width  Width of the padded Feature Map the taps will be applied to.
+@param taps         The location where the taps will be stored. Must hold kH * kW taps.
+@return             The number of nonzero taps.
+*/
+int build_sparse_taps(float* g, int kH, int kW, int total_width, sparse_tap* taps){
+
+    const int M = (kH - 1) / 2;
+    const int N = (kW - 1) / 2;
+
+    int count = 0;
+    for (int j = 0; j < kW; j++){
+        for (int i = 0; i < kH; i++){
+            const float weight = g[IDX(i, j, kW)];
+            if (weight == 0.0f) { continue; }
+            taps[count].offset = IDX(i - M, j - N, total_width);
+            taps[count].weight = weight;
+            count++;
+        }
+    }
+    return count;
+}
+
+
+/* 
+* Performs parallel 2D discrete convolutions with a sparse kernel, applying only its nonzero taps.
+* Each tap is applied to a block of neighbouring outputs at once, which vectorises regardless of the
+* kernel's shape, so the cost is proportional to the number of nonzero taps.
+* @param f             Pointer to the Feature Map.
+* @param H             Height of the Feature Map.
+* @param W             Width of the Feature Map.
+* @param taps          The nonzero taps, from build_sparse_taps() for this Feature Map's padded width.
+* @param tap_count     The number of taps.
+* @param w_padding     Width of the padding in the Feature Map.
+* @param h_padding     Height of the padding in the Feature Map.
+* @param output        Pointer to the location where outputs are stored.
+*/
+int sparse_conv2d(float* f, int H, int W, sparse_tap* taps, int tap_count, int w_padding, int h_padding, float* output){
+
+    const int total_width = W + w_padding*2;
+
+    #pragma omp parallel for schedule(static)
+    for (int n = h_padding; n < H + h_padding; n++){
+        for (int block = 0; block < W; block += SPARSE_BLOCK){
+
+            const int block_width = min(SPARSE_BLOCK, W - block);
+            float* out = output + IDX(n - h_padding, block, W);
+            const float* centre = f + IDX(n, block + w_padding, total_width);
+
+            for (int k = 0; k < block_width; k++){
+                out[k] = 0.0f;
+            }
+
+            for (int t = 0; t < tap_count; t++){
+                const float weight = taps[t].weight;
+                const float* in = centre + taps[t].offset;
+
+                #pragma omp simd
+                for (int k = 0; k < block_width; k++){
+                    out[k] += in[k] * weight;
+                }
+            }
+        }
+    }
+    return 0;
+}
+
+
+/*
+Checks whether every tap of a kernel has the same nonzero value.
+@param g        Pointer to the Kernel.
+@param kH       Height of the Kernel.
+@param kW       Width of the Kernel.
+@param value    The location where the common value will be stored, if there is one.
+@return         1 for a box kernel, or 0 if not.
+*/
+int is_box_kernel(float* g, int kH, int kW, float* value){
+    if (g[0] == 0.0f) { return 0; }
+    for (int i = 1; i < kH * kW; i++){
+        if (g[i] != g[0]) { return 0; }
+    }
+    *value = g[0];
+    return 1;
+}
+
+
+/* 
+* Performs 2D discrete convolutions with a box kernel in O(1) work per output, whatever its size.
+* Each thread takes a band of output rows and keeps, for every column, the sum of the kH input rows under
+* the window. Moving down a row adds the row entering the window and subtracts the one leaving it. A
+* prefix sum over those column sums then gives every output's kW-wide window sum as one subtraction.
+* Sums are kept in double so that the running additions and subtractions don't drift.
+* Zero padding is read from the padded Feature Map, so borders match conv2d() exactly.
+* @param f             Pointer to the Feature Map.
+* @param H             Height of the Feature Map.
+* @param W             Width of the Feature Map.
+* @param value         The value of every kernel tap.
+* @param kH            Height of the Kernel.
+* @param kW            Width of the Kernel.
+* @param w_padding     Width of the padding in the Feature Map.
+* @param h_padding     Height of the padding in the Feature Map.
+* @param output        Pointer to the location where outputs are stored.
+*/
+int box_conv2d(float* f, int H, int W, float value, int kH, int kW, int w_padding, int h_padding, float* output){
+
+    const int total_width = W + w_padding*2;
+
+    // dimensions for convolution window
+    const int M = (kH - 1) / 2;
+    const int N = (kW - 1) / 2;
+
+    int failed = 0;
+
+    #pragma omp parallel reduction(|:failed)
+    {
+        double* column_sums = (double*)malloc(total_width * sizeof(double));
+        double* prefix = (double*)malloc((total_width + 1) * sizeof(double));
+        failed = column_sums == NULL || prefix == NULL;
+
+        // The same static row partition as the other engines, so first-touch placement still applies
+        const int thread = omp_get_thread_num();
+        const int thread_count = omp_get_num_threads();
+        const int first = h_padding + (int)((long long)H * thread / thread_count);
+        const int last = h_padding + (int)((long long)H * (thread + 1) / thread_count);
+
+        for (int n = first; n < last && !failed; n++){
+
+            if (n == first){
+                // Sum the whole window for the band's first row
+                for (int x = 0; x < total_width; x++) { column_sums[x] = 0.0; }
+                for (int i = 0; i < kH; i++){
+                    const float* row = f + IDX(n + i - M, 0, total_width);
+                    #pragma omp simd
+                    for (int x = 0; x < total_width; x++) { column_sums[x] += row[x]; }
+                }
+            } else {
+                // Slide the window down one row
+                const float* entering = f + IDX(n - M + kH - 1, 0, total_width);
+                const float* leaving = f + IDX(n - M - 1, 0, total_width);
+                #pragma omp simd
+                for (int x = 0; x < total_width; x++) { column_sums[x] += (double)entering[x] - (double)leaving[x]; }
+            }
+
+            prefix[0] = 0.0;
+            for (int x = 0; x < total_width; x++) { prefix[x + 1] = prefix[x] + column_sums[x]; }
+
+            // Output k's window covers padded columns k + w_padding - N up to kW columns further
+            float* out = output + IDX(n - h_padding, 0, W);
+            const double* window_start = prefix + w_padding - N;
+            #pragma omp simd
+            for (int k = 0; k < W; k++){
+                out[k] = (float)(value * (window_start[k + kW] - window_start[k]));
+            }
+        }
+
+        free(column_sums);
+        free(prefix);
+    }
+    return failed;
+}
+
+
+/*
+Computes the recursive Gaussian coefficients for a sigma of at least GAUSSIAN_MIN_SIGMA, following Young,
+van Vliet and van Ginkel (2002): the three poles of van Vliet, Young and Verbeek (1998) are raised to the
+power 1/q, with q chosen so that the forward-backward filter's variance is exactly sigma^2.
+Also builds the Triggs-Sdika (2006) boundary matrix, which gives the anticausal pass the state it would have
+after running through infinite zero padding, from the causal pass's last three outputs. It's found by
+running both passes over the zero padding once for each of the three unit states.
+@param sigma    Standard deviation of the Gaussian, in pixels.
+@param c        The location where the coefficients will be stored.
+@return         0 on success, or 1 if the scratch space couldn't be allocated.
+*/
+int gaussian_iir_coefficients(double sigma, gaussian_coefficients* c){
+
+    // The L-infinity optimised poles for q = 1
+    const double complex pair = GAUSSIAN_POLE_REAL + GAUSSIAN_POLE_IMAGINARY * I;
+    const double single = GAUSSIAN_POLE_SINGLE;
+
+    // Each pole d adds 2d / (d - 1)^2 to the variance, which grows with q, so q is found by bisection
+    double lo = 0.0, hi = 4.0 * sigma + 4.0;
+    for (int iteration = 0; iteration < 100; iteration++){
+        const double q = 0.5 * (lo + hi);
+        const double complex d = cpow(pair, 1.0 / q);
+        const double e = pow(single, 1.0 / q);
+        const double variance = 2.0 * creal(2.0 * d / ((d - 1.0) * (d - 1.0))) + 2.0 * e / ((e - 1.0) * (e - 1.0));
+        if (variance < sigma * sigma) { lo = q; } else { hi = q; }
+    }
+    const double q = 0.5 * (lo + hi);
+
+    // 1 / ((1 - z/d)(1 - z/conj(d))(1 - z/e)), expanded into y[n] = gain * x[n] + a1 * y[n-1] + ...
+    const double complex d = cpow(pair, 1.0 / q);
+    const double e = pow(single, 1.0 / q);
+    const double modulus = cabs(d);
+    const double cosine = creal(d) / modulus;
+    c->a1 = 2.0 * cosine / modulus + 1.0 / e;
+    c->a2 = -(1.0 / (modulus * modulus) + 2.0 * cosine / (modulus * e));
+    c->a3 = 1.0 / (modulus * modulus * e);
+    c->gain = 1.0 - (c->a1 + c->a2 + c->a3);
+
+    // Column j of the boundary matrix is the anticausal start for causal outputs (w[N-1], w[N-2], w[N-3]) = e_j
+    double* tail = (double*)malloc(GAUSSIAN_MAX_TAIL * sizeof(double));
+    if (tail == NULL) { return 1; }
+
+    for (int j = 0; j < 3; j++){
+
+        // The causal pass carries on into the zeros after the line until its response is negligible
+        double w1 = j == 0, w2 = j == 1, w3 = j == 2;
+        int length = 0;
+        while (length < GAUSSIAN_MAX_TAIL){
+            const double w = c->a1 * w1 + c->a2 * w2 + c->a3 * w3;
+            w3 = w2; w2 = w1; w1 = w;
+            tail[length++] = w;
+            if (length > 3 && fabs(w1) + fabs(w2) + fabs(w3) < GAUSSIAN_TAIL_TOLERANCE) { break; }
+        }
+
+        // The anticausal pass comes back through it, starting from rest
+        double y1 = 0.0, y2 = 0.0, y3 = 0.0;
+        for (int n = length - 1; n >= 0; n--){
+            const double y = c->gain * tail[n] + c->a1 * y1 + c->a2 * y2 + c->a3 * y3;
+            y3 = y2; y2 = y1; y1 = y;
+            if (n < 3) { c->boundary[IDX(n, j, 3)] = y; }
+        }
+    }
+
+    free(tail);
+    return 0;
+}
+
+
+/*
+Starts an anticausal pass at the end of a line, from the causal pass's last three outputs, as though both
+passes had run on through infinite zero padding.
+@param c            The coefficients, from gaussian_iir_coefficients().
+@param w1           The causal output at the last position.
+@param w2           The causal output one before it.
+@param w3           The causal output two before it.
+@param y1           The location where the anticausal output one past the end will be stored.
+@param y2           The location where the anticausal output two past the end will be stored.
+@param y3           The location where the anticausal output three past the end will be stored.
+*/
+void gaussian_iir_boundary(const gaussian_coefficients* c, double w1, double w2, double w3, double* y1, double* y2, double* y3){
+    *y1 = c->boundary[0] * w1 + c->boundary[1] * w2 + c->boundary[2] * w3;
+    *y2 = c->boundary[3] * w1 + c->boundary[4] * w2 + c->boundary[5] * w3;
+    *y3 = c->boundary[6] * w1 + c->boundary[7] * w2 + c->boundary[8] * w3;
+}
+
+
+/*
+Filters a band of GAUSSIAN_ROWS lines in place, each along its length, with the causal then anticausal
+recursions. Line r's value x is at band[x * GAUSSIAN_ROWS + r], so every step is one vector across the
+lines.
+*/
+void gaussian_iir_band(float* band, int length, const gaussian_coefficients* c){
+
+    double s1[GAUSSIAN_ROWS] = {0}, s2[GAUSSIAN_ROWS] = {0}, s3[GAUSSIAN_ROWS] = {0};
+
+    for (int x = 0; x < length; x++){
+        float* values = band + (size_t)x * GAUSSIAN_ROWS;
+        #pragma omp simd
+        for (int r = 0; r < GAUSSIAN_ROWS; r++){
+            const double w = c->gain * values[r] + c->a1 * s1[r] + c->a2 * s2[r] + c->a3 * s3[r];
+            s3[r] = s2[r]; s2[r] = s1[r]; s1[r] = w;
+            values[r] = (float)w;
+        }
+    }
+
+    for (int r = 0; r < GAUSSIAN_ROWS; r++) { gaussian_iir_boundary(c, s1[r], s2[r], s3[r], &s1[r], &s2[r], &s3[r]); }
+
+    for (int x = length - 1; x >= 0; x--){
+        float* values = band + (size_t)x * GAUSSIAN_ROWS;
+        #pragma omp simd
+        for (int r = 0; r < GAUSSIAN_ROWS; r++){
+            const double y = c->gain * values[r] + c->a1 * s1[r] + c->a2 * s2[r] + c->a3 * s3[r];
+            s3[r] = s2[r]; s2[r] = s1[r]; s1[r] = y;
+            values[r] = (float)y;
+        }
+    }
+}
+
+
+/* 
+* Applies a Gaussian blur with a recursive (IIR) filter, whose cost per output doesn't depend on sigma.
+* The horizontal pass works on bands of GAUSSIAN_ROWS rows, transposed tile by tile into a scratch buffer,
+* so the recursion along each row runs as one vector across the band's rows. The vertical pass then runs
+* down blocks of columns in place, which are already contiguous, so it needs no transpose.
+* Outside the feature map is zero, like the "same" padding of the other engines.
+* @param f             Pointer to the Feature Map.
+* @param H             Height of the Feature Map.
+* @param W             Width of the Feature Map.
+* @param sigma         Standard deviation of the Gaussian, in pixels. At least GAUSSIAN_MIN_SIGMA.
+* @param w_padding     Width of the padding in the Feature Map.
+* @param h_padding     Height of the padding in the Feature Map.
+* @param output        Pointer to the location where outputs are stored.
+*/
+int gaussian_filter(float* f, int H, int W, double sigma, int w_padding, int h_padding, float* output){
+
+    const int total_width = W + w_padding*2;
+    gaussian_coefficients c;
+    if (gaussian_iir_coefficients(sigma, &c) != 0) { return 1; }
+
+    int failed = 0;
+
+    #pragma omp parallel reduction(|:failed)
+    {
+        float* band = NULL;
+        failed = posix_memalign((void**)&band, 64, (size_t)W * GAUSSIAN_ROWS * sizeof(float)) != 0;
+
+        // Horizontal pass, from the feature map into the outputs
+        #pragma omp for schedule(static)
+        for (int first = 0; first < H; first += GAUSSIAN_ROWS){
+            if (failed) { continue; }
+
+            const int rows = min(GAUSSIAN_ROWS, H - first);
+
+            // Transpose in GAUSSIAN_ROWS-square tiles, so both sides stay in cache
+            for (int tile = 0; tile < W; tile += GAUSSIAN_ROWS){
+                const int tile_width = min(GAUSSIAN_ROWS, W - tile);
+                for (int r = 0; r < GAUSSIAN_ROWS; r++){
+                    const float* row = r < rows ? f + IDX(first + r + h_padding, tile + w_padding, total_width) : NULL;
+                    for (int x = 0; x < tile_width; x++){
+                        band[(size_t)(tile + x) * GAUSSIAN_ROWS + r] = row != NULL ? row[x] : 0.0f;
+                    }
+                }
+            }
+
+            gaussian_iir_band(band, W, &c);
+
+            for (int tile = 0; tile < W; tile += GAUSSIAN_ROWS){
+                const int tile_width = min(GAUSSIAN_ROWS, W - tile);
+                for (int r = 0; r < rows; r++){
+                    float* row = output + IDX(first + r, tile, W);
+                    for (int x = 0; x < tile_width; x++){
+                        row[x] = band[(size_t)(tile + x) * GAUSSIAN_ROWS + r];
+                    }
+                }
+            }
+        }
+
+        // Vertical pass, in place, down each block of columns
+        #pragma omp for schedule(static)
+        for (int first = 0; first < W; first += GAUSSIAN_COLUMNS){
+            if (failed) { continue; }
+
+            const int columns = min(GAUSSIAN_COLUMNS, W - first);
+            double s1[GAUSSIAN_COLUMNS] = {0}, s2[GAUSSIAN_COLUMNS] = {0}, s3[GAUSSIAN_COLUMNS] = {0};
+
+            for (int n = 0; n < H; n++){
+                float* values = output + IDX(n, first, W);
+                #pragma omp simd
+                for (int k = 0; k < columns; k++){
+                    const double w = c.gain * values[k] + c.a1 * s1[k] + c.a2 * s2[k] + c.a3 * s3[k];
+                    s3[k] = s2[k]; s2[k] = s1[k]; s1[k] = w;
+                    values[k] = (float)w;
+                }
+            }
+
+            for (int k = 0; k < columns; k++) { gaussian_iir_boundary(&c, s1[k], s2[k], s3[k], &s1[k], &s2[k], &s3[k]); }
+
+            for (int n = H - 1; n >= 0; n--){
+                float* values = output + IDX(n, first, W);
+                #pragma omp simd
+                for (int k = 0; k < columns; k++){
+                    const double y = c.gain * values[k] + c.a1 * s1[k] + c.a2 * s2[k] + c.a3 * s3[k];
+                    s3[k] = s2[k]; s2[k] = s1[k]; s1[k] = y;
+                    values[k] = (float)y;
+                }
+            }
+        }
+
+        free(band);
+    }
+    return failed;
+}
+
+
+/*
+Parses the kernel list of -pipeline or -stencil: comma-separated stages, each a kernel file or a size to
+generate ("5x5"), optionally followed by the stage's accumulator (":fp32" or ":fp64"). For example
+"blur.txt,3x3:fp64,g.bin".
+@param spec             The spec. It's split in place.
+@param stages           An array of MAX_PIPELINE_STAGES stages, into which the kernels are loaded.
+@param stage_count      The location where the number of stages will be stored.
+@return                 0 on success, or 1 with a message printed if the spec or a kernel is invalid.
+*/
+int parse_pipeline(char* spec, pipeline_stage* stages, int* stage_count){
+
+    // extract_data() uses strtok() on text files, so the list keeps its own position
+    char* position = NULL;
+    *stage_count = 0;
+    for (char* token = strtok_r(spec, ",", &position); token != NULL; token = strtok_r(NULL, ",", &position)){
+
+        if (*stage_count == MAX_PIPELINE_STAGES){
+            printf("Please provide at most %d kernels.\n", MAX_PIPELINE_STAGES);
+            return 1;
+        }
+        pipeline_stage* stage = &stages[(*stage_count)++];
+        stage->g = NULL;
+        stage->accumulator = ACCUMULATE_FP32;
+
+        char* mode = strrchr(token, ':');
+        if (mode != NULL){
+            *mode++ = '\0';
+            stage->accumulator = parse_accumulator(mode);
+            if (stage->accumulator != ACCUMULATE_FP32 && stage->accumulator != ACCUMULATE_FP64){
+                printf("Unknown kernel mode %s. Please provide fp32 or fp64.\n", mode);
+                return 1;
+            }
+        }
+
+        char rest = '\0';
+        if (sscanf(token, "%dx%d%c", &stage->kH, &stage->kW, &rest) == 2){
+            if (stage->kH < 1 || stage->kW < 1){
+                printf("Please provide only positive kernel sizes.\n");
+                return 1;
+            }
+            stage->g = (float*)malloc((size_t)stage->kH * stage->kW * sizeof(float));
+            if (stage->g == NULL) { printf("Error allocating memory for kernel.\n"); return 1; }
+            generate_data(stage->kH, stage->kW, 0, 0, &stage->g);
+            continue;
+        }
+
+        if (extract_dimensions(token, &stage->kH, &stage->kW) != 0){
+            printf("Error extracting kernel dimensions from %s.\n", token);
+            return 1;
+        }
+        stage->g = (float*)malloc((size_t)stage->kH * stage->kW * sizeof(float));
+        if (stage->g == NULL) { printf("Error allocating memory for kernel.\n"); return 1; }
+        if (extract_data(token, stage->kW, stage->kH, 0, 0, &stage->g) != 0){
+            printf("Error extracting kernel data from %s.\n", token);
+            return 1;
+        }
+    }
+
+    if (*stage_count == 0){
+        printf("Please provide at least one kernel.\n");
+        return 1;
+    }
+    return 0;
+}
+
+
+/*
+Convolves one output tile through every stage of a pipeline. Each stage's outputs are only computed over
+the tile plus the halo the later stages still need, into one of two scratch buffers that alternate between
+stages, so the intermediates stay in cache and never exist at full size. Halo positions outside the map
+are zero, as the "same" padding of a separate run would be. Taps are summed in convolve_tile()'s order.
+@param job          The pipeline and its feature map and outputs.
+@param tile         The output tile.
+@param scratch      Two buffers of job->buffer_floats floats, then job->buffer_width doubles.
+*/
+void convolve_fused_tile(pipeline_job* job, conv_tile tile, float* scratch){
+
+    const int H = job->H;
+    const int W = job->W;
+    const int rows = min(TILE_HEIGHT, H - tile.row);
+    const int columns = min(TILE_WIDTH, W - tile.column);
+    double* wide = (double*)(scratch + 2 * job->buffer_floats);
+
+    // How far beyond the tile the stages after the current one still reach
+    int reach_h = 0, reach_w = 0;
+    for (int s = 1; s < job->stage_count; s++){
+        reach_h += job->stages[s].kH / 2;
+        reach_w += job->stages[s].kW / 2;
+    }
+
+    // The current stage's input. Map position (y, x) is at in[IDX(y - in_row, x - in_column, in_width)].
+    const float* in = job->f;
+    int in_row = -job->h_padding, in_column = -job->w_padding, in_width = W + job->w_padding*2;
+
+    for (int s = 0; s < job->stage_count; s++){
+        const pipeline_stage* stage = &job->stages[s];
+        const int M = (stage->kH - 1) / 2;
+        const int N = (stage->kW - 1) / 2;
+
+        // The last stage writes straight into the outputs
+        const int last = s == job->stage_count - 1;
+        float* out = last ? job->output : scratch + (s % 2) * job->buffer_floats;
+        const int out_row = last ? 0 : tile.row - reach_h;
+        const int out_column = last ? 0 : tile.column - reach_w;
+        const int out_width = last ? W : columns + reach_w*2;
+
+        const int first_column = tile.column - reach_w;
+        const int end_column = tile.column + columns + reach_w;
+        const int x0 = max(first_column, 0);
+        const int x1 = min(end_column, W);
+        const int count = x1 - x0;
+
+        for (int y = tile.row - reach_h; y < tile.row + rows + reach_h; y++){
+            float* row = out + IDX(y - out_row, first_column - out_column, out_width);
+
+            if (y < 0 || y >= H){
+                memset(row, 0, (size_t)(end_column - first_column) * sizeof(float));
+                continue;
+            }
+            memset(row, 0, (size_t)(x0 - first_column) * sizeof(float));
+            memset(row + (x1 - first_column), 0, (size_t)(end_column - x1) * sizeof(float));
+
+            float* values = row + (x0 - first_column);
+            if (stage->accumulator == ACCUMULATE_FP64){
+                for (int k = 0; k < count; k++) { wide[k] = 0.0; }
+            } else {
+                for (int k = 0; k < count; k++) { values[k] = 0.0f; }
+            }
+
+            for (int i = 0; i < stage->kH; i++){
+                const float* source = in + IDX(y + i - M - in_row, x0 - N - in_column, in_width);
+                for (int j = 0; j < stage->kW; j++){
+                    const float weight = stage->g[IDX(i, j, stage->kW)];
+                    if (stage->accumulator == ACCUMULATE_FP64){
+                        #pragma omp simd
+                        for (int k = 0; k < count; k++){
+                            wide[k] += (double)source[k + j] * weight;
+                        }
+                    } else {
+                        #pragma omp simd
+                        for (int k = 0; k < count; k++){
+                            values[k] += source[k + j] * weight;
+                        }
+                    }
+                }
+            }
+
+            if (stage->accumulator == ACCUMULATE_FP64){
+                for (int k = 0; k < count; k++) { values[k] = (float)wide[k]; }
+            }
+        }
+
+        in = out;
+        in_row = out_row;
+        in_column = out_column;
+        in_width = out_width;
+
+        if (!last){
+            reach_h -= job->stages[s + 1].kH / 2;
+            reach_w -= job->stages[s + 1].kW / 2;
+        }
+    }
+}
+
+
+// Runs one tile of a pipeline_conv2d() job on the pthreads pool, with its own scratch
+void pipeline_task(void* job, int task){
+    pipeline_job* j = (pipeline_job*)job;
+    float* scratch = NULL;
+    if (posix_memalign((void**)&scratch, 64, j->scratch_bytes) != 0){
+        atomic_store(&j->failed, 1);
+        return;
+    }
+    convolve_fused_tile(j, j->tiles[task], scratch);
+    free(scratch);
+}
+
+
+/* 
+* Runs a chain of convolutions with layer fusion: each output tile is carried through every stage before
+* the next tile starts, recomputing the overlapping halos of the intermediate stages rather than writing
+* them out. Only the feature map is read from memory and only the final outputs are written, instead of
+* a full-size intermediate map (or file) per stage. Tiles are the Hilbert-ordered ones of tiled_conv2d().
+* Every stage uses "same" padding, so the result is the same as separate runs of the stages with
+* -tiled (for fp32 stages) fed into each other.
+* @param f             Pointer to the Feature Map, padded for the first stage.
+* @param H             Height of the Feature Map.
+* @param W             Width of the Feature Map.
+* @param stages        The stages, in order.
+* @param stage_count   The number of stages.
+* @param w_padding     Width of the padding in the Feature Map.
+* @param h_padding     Height of the padding in the Feature Map.
+* @param output        Pointer to the location where outputs are stored.
+*/
+int pipeline_conv2d(float* f, int H, int W, pipeline_stage* stages, int stage_count, int w_padding, int h_padding, float* output){
+
+    pipeline_job job = { f, H, W, stages, stage_count, w_padding, h_padding, output, NULL, 0, 0, 0, 0 };
+    const int tile_count = build_tile_order(H, W, &job.tiles);
+    if (tile_count < 0) { return 1; }
+
+    // The first stage's outputs cover the widest halo, so they size both buffers
+    int reach_h = 0, reach_w = 0;
+    for (int s = 1; s < stage_count; s++){
+        reach_h += stages[s].kH / 2;
+        reach_w += stages[s].kW / 2;
+    }
+    job.buffer_width = TILE_WIDTH + reach_w*2;
+    job.buffer_floats = ((size_t)(TILE_HEIGHT + reach_h*2) * job.buffer_width + 15) / 16 * 16;
+    job.scratch_bytes = 2 * job.buffer_floats * sizeof(float) + (size_t)job.buffer_width * sizeof(double);
+    atomic_init(&job.failed, 0);
+
+#ifdef _OPENMP
+    int failed = 0;
+
+    #pragma omp parallel reduction(|:failed)
+    {
+        float* scratch = NULL;
+        failed = posix_memalign((void**)&scratch, 64, job.scratch_bytes) != 0;
+
+        // Halo tiles at the map's edges do less work, so tiles are handed out as threads become free
+        #pragma omp for schedule(dynamic)
+        for (int t = 0; t < tile_count; t++){
+            if (failed) { continue; }
+            convolve_fused_tile(&job, job.tiles[t], scratch);
+        }
+
+        free(scratch);
+    }
+#else
+    if (external_executor != NULL){
+        external_executor(external_context, pipeline_task, &job, tile_count);
+    } else {
+        if (!pool.running && thread_pool_start(omp_get_max_threads()) != 0){
+            free(job.tiles);
+            return 1;
+        }
+        pool_execute(NULL, pipeline_task, &job, tile_count);
+    }
+    const int failed = atomic_load(&job.failed);
+#endif
+
+    free(job.tiles);
+    return failed;
+}
+
+
+/*
+Runs a pipeline's stages one after another, with a full-size intermediate map between each pair, as
+separate runs would. Used to check pipeline_conv2d().
+@param f             Pointer to the Feature Map, padded for the first stage.
+@param H             Height of the Feature Map.
+@param W             Width of the Feature Map.
+@param stages        The stages, in order.
+@param stage_count   The number of stages.
+@param w_padding     Width of the padding in the Feature Map.
+@param h_padding     Height of the padding in the Feature Map.
+@param last_input    The location where the last stage's padded input will be stored, to be freed by
+                     the caller. This is f itself for a single stage.
+*/
+int unfused_pipeline(float* f, int H, int W, pipeline_stage* stages, int stage_count, int w_padding, int h_padding, float** last_input){
+
+    float* input = f;
+    for (int s = 0; s < stage_count - 1; s++){
+
+        // Each intermediate is padded for the stage that reads it
+        const int next_h = stages[s + 1].kH / 2;
+        const int next_w = stages[s + 1].kW / 2;
+        const int next_width = W + next_w*2;
+        float* next = (float*)calloc((size_t)(H + next_h*2) * next_width, sizeof(float));
+        float* outputs = (float*)malloc((size_t)H * W * sizeof(float));
+        if (next == NULL || outputs == NULL){
+            free(next); free(outputs);
+            if (input != f) { free(input); }
+            return 1;
+        }
+
+        if (stages[s].accumulator == ACCUMULATE_FP64){
+            accumulate_conv2d(input, H, W, stages[s].g, stages[s].kH, stages[s].kW, w_padding, h_padding, outputs, ACCUMULATE_FP64);
+        } else {
+            tiled_conv2d(input, H, W, stages[s].g, stages[s].kH, stages[s].kW, w_padding, h_padding, outputs);
+        }
+        for (int i = 0; i < H; i++){
+            memcpy(next + IDX(i + next_h, next_w, next_width), outputs + IDX(i, 0, W), W * sizeof(float));
+        }
+
+        free(outputs);
+        if (input != f) { free(input); }
+        input = next;
+        w_padding = next_w;
+        h_padding = next_h;
+    }
+
+    *last_input = input;
+    return 0;
+}
+
+
+/*
+Parses a -stencil reduction name.
+@return     The STENCIL_ reduction for the name, or -1 if it isn't recognised.
+*/
+int parse_stencil(const char* name){
+    if (strcmp(name, "magnitude") == 0) { return STENCIL_MAGNITUDE; }
+    if (strcmp(name, "max") == 0) { return STENCIL_MAX; }
+    if (strcmp(name, "sumsq") == 0) { return STENCIL_SUM_SQUARES; }
+    if (strcmp(name, "argmax") == 0) { return STENCIL_ARGMAX; }
+    return -1;
+}
+
+
+/* 
+* Evaluates several kernels of the same size over each input window in one sweep, and combines their
+* responses before storing, as for the Gx and Gy of an edge detector. Each block of STENCIL_BLOCK outputs
+* accumulates one row of responses per kernel, tap by tap from the same cached input rows, so the feature
+* map is read once and only the combined map is written:
+*   STENCIL_MAGNITUDE     sqrt of the sum of the squared responses, e.g. the Sobel gradient magnitude.
+*   STENCIL_MAX           The largest response.
+*   STENCIL_SUM_SQUARES   The sum of the squared responses.
+*   STENCIL_ARGMAX        The index of the kernel with the largest response, e.g. the direction of the
+*                         strongest of a set of compass kernels. Ties go to the first.
+* Each response sums its taps in convolve_tile()'s order, so it's the same as a separate -tiled run.
+* @param f             Pointer to the Feature Map.
+* @param H             Height of the Feature Map.
+* @param W             Width of the Feature Map.
+* @param kernels       The kernels, all of the same size.
+* @param kernel_count  The number of kernels.
+* @param w_padding     Width of the padding in the Feature Map.
+* @param h_padding     Height of the padding in the Feature Map.
+* @param output        Pointer to the location where outputs are stored.
+* @param reduction     One of the STENCIL_ reductions.
+*/
+int stencil_conv2d(float* f, int H, int W, pipeline_stage* kernels, int kernel_count, int w_padding, int h_padding, float* output, int reduction){
+
+    const int total_width = W + w_padding*2;
+    const int kH = kernels[0].kH;
+    const int kW = kernels[0].kW;
+    const conv_epilogue epilogue = conv2d_epilogue;
+
+    // dimensions for convolution window
+    const int M = (kH - 1) / 2;
+    const int N = (kW - 1) / 2;
+
+    int failed = 0;
+
+    #pragma omp parallel reduction(|:failed)
+    {
+        float* responses = NULL;
+        failed = posix_memalign((void**)&responses, 64, (size_t)(kernel_count + 1) * STENCIL_BLOCK * sizeof(float)) != 0;
+
+        #pragma omp for schedule(static)
+        for (int n = 0; n < H; n++){
+            if (failed) { continue; }
+
+            for (int first = 0; first < W; first += STENCIL_BLOCK){
+                const int columns = min(STENCIL_BLOCK, W - first);
+                for (int k = 0; k < kernel_count * STENCIL_BLOCK; k++) { responses[k] = 0.0f; }
+
+                for (int i = 0; i < kH; i++){
+                    const float* in = f + IDX(n + h_padding + i - M, first + w_padding - N, total_width);
+                    for (int j = 0; j < kW; j++){
+                        for (int c = 0; c < kernel_count; c++){
+                            const float weight = kernels[c].g[IDX(i, j, kW)];
+                            float* response = responses + c * STENCIL_BLOCK;
+
+                            #pragma omp simd
+                            for (int k = 0; k < columns; k++){
+                                response[k] += in[k + j] * weight;
+                            }
+                        }
+                    }
+                }
+
+                // Combine the responses into the first row, then store it
+                float* combined = responses;
+                if (reduction == STENCIL_MAGNITUDE || reduction == STENCIL_SUM_SQUARES){
+                    for (int k = 0; k < columns; k++) { combined[k] *= combined[k]; }
+                    for (int c = 1; c < kernel_count; c++){
+                        const float* response = responses + c * STENCIL_BLOCK;
+                        #pragma omp simd
+                        for (int k = 0; k < columns; k++) { combined[k] += response[k] * response[k]; }
+                    }
+                    if (reduction == STENCIL_MAGNITUDE){
+                        #pragma omp simd
+                        for (int k = 0; k < columns; k++) { combined[k] = sqrtf(combined[k]); }
+                    }
+                } else {
+                    // The index of the running max is kept in the extra row
+                    float* index = responses + kernel_count * STENCIL_BLOCK;
+                    for (int k = 0; k < columns; k++) { index[k] = 0.0f; }
+                    for (int c = 1; c < kernel_count; c++){
+                        const float* response = responses + c * STENCIL_BLOCK;
+                        #pragma omp simd
+                        for (int k = 0; k < columns; k++){
+                            const int larger = response[k] > combined[k];
+                            index[k] = larger ? (float)c : index[k];
+                            combined[k] = larger ? response[k] : combined[k];
+                        }
+                    }
+                    if (reduction == STENCIL_ARGMAX) { combined = index; }
+                }
+
+                if (epilogue.enabled) { apply_epilogue_row(combined, columns, &epilogue); }
+                memcpy(output + IDX(n, first, W), combined, columns * sizeof(float));
+            }
+        }
+
+        free(responses);
+    }
+    return failed;
+}
+
+
+/*
+Computes one output tile of conv2d_transpose(). Like convolve_tile(), each output row accumulates whole
+rows of taps, so the inner loop runs across neighbouring outputs.
+*/
+void transpose_tile(float* f, int H, int W, float* g, int kH, int kW, int w_padding, int h_padding, float* output, conv_tile tile){
+
+    const int total_width = W + w_padding*2;
+
+    // dimensions for convolution window
+    const int M = (kH - 1) / 2;
+    const int N = (kW - 1) / 2;
+
+    const int rows = min(TILE_HEIGHT, H - tile.row);
+    const int columns = min(TILE_WIDTH, W - tile.column);
+
+    for (int n = tile.row; n < tile.row + rows; n++){
+        float* out = output + IDX(n, tile.column, W);
+        for (int k = 0; k < columns; k++) { out[k] = 0.0f; }
+
+        // Tap (i, j) carried the input at (n, k) to the output at (n - i + M, k - j + N)
+        for (int i = 0; i < kH; i++){
+            const float* in = f + IDX(n + h_padding - i + M, tile.column + w_padding + N, total_width);
+            for (int j = 0; j < kW; j++){
+                const float weight = g[IDX(i, j, kW)];
+
+                #pragma omp simd
+                for (int k = 0; k < columns; k++){
+                    out[k] += in[k - j] * weight;
+                }
+            }
+        }
+    }
+}
+
+
+/* 
+* Performs the transposed convolution: the gradient of conv2d()'s outputs with respect to its feature map.
+* Each input gathers the output gradients of every window that read it, which is a convolution of the
+* padded output gradient with the kernel flipped in both directions. Runs transpose_tile() on the same
+* Hilbert-ordered tiles and work stealing as tiled_conv2d(), through run_tiles().
+* @param f             Pointer to the gradient of the outputs, padded like a Feature Map.
+* @param H             Height of the Feature Map.
+* @param W             Width of the Feature Map.
+* @param g             Pointer to the Kernel.
+* @param kH            Height of the Kernel.
+* @param kW            Width of the Kernel.
+* @param w_padding     Width of the padding around the gradient.
+* @param h_padding     Height of the padding around the gradient.
+* @param output        Pointer to the location where the gradient of the Feature Map is stored.
+*/
+int conv2d_transpose(float* f, int H, int W, float* g, int kH, int kW, int w_padding, int h_padding, float* output){
+#ifdef _OPENMP
+    return run_tiles(transpose_tile, f, H, W, g, kH, kW, w_padding, h_padding, output, 0);
+#else
+    return run_tiles(transpose_tile, f, H, W, g, kH, kW, w_padding, h_padding, output, 1);
+#endif
+}
+
+
+/*
+Sums a run of a conv2d_weight_grad() job's tiles into one kH x kW accumulator. Each tile row's dot products
+are vectorised in float, then added to the accumulator in double.
+@param job          The job.
+@param first_tile   The first tile of the run.
+@param last_tile    One past the last tile of the run.
+@param partial      The accumulator, which the run's sums are added to.
+*/
+void weight_grad_tiles(const weight_grad_job* job, int first_tile, int last_tile, double* partial){
+
+    const int kH = job->kH;
+    const int kW = job->kW;
+    const int W = job->W;
+    const int total_width = W + job->w_padding*2;
+
+    // dimensions for convolution window
+    const int M = (kH - 1) / 2;
+    const int N = (kW - 1) / 2;
+
+    for (int t = first_tile; t < last_tile; t++){
+        const conv_tile tile = job->tiles[t];
+        const int rows = min(TILE_HEIGHT, job->H - tile.row);
+        const int columns = min(TILE_WIDTH, W - tile.column);
+
+        for (int n = tile.row; n < tile.row + rows; n++){
+            const float* d = job->grad_output + IDX(n, tile.column, W);
+            for (int i = 0; i < kH; i++){
+                const float* in = job->f + IDX(n + job->h_padding + i - M, tile.column + job->w_padding - N, total_width);
+                for (int j = 0; j < kW; j++){
+                    float sum = 0.0f;
+
+                    #pragma omp simd reduction(+:sum)
+                    for (int k = 0; k < columns; k++){
+                        sum += in[k + j] * d[k];
+                    }
+                    partial[IDX(i, j, kW)] += sum;
+                }
+            }
+        }
+    }
+}
+
+
+// Runs one task of a conv2d_weight_grad() job on the pthreads pool: its run of tiles, into its own partial
+void weight_grad_task(void* job, int task){
+    weight_grad_job* j = (weight_grad_job*)job;
+    double* partial = j->partials + task * j->stride;
+    for (int t = 0; t < j->kH * j->kW; t++) { partial[t] = 0.0; }
+
+    const int first_tile = (int)((long long)j->tile_count * task / j->task_count);
+    const int last_tile = (int)((long long)j->tile_count * (task + 1) / j->task_count);
+    weight_grad_tiles(j, first_tile, last_tile, partial);
+}
+
+
+/* 
+* Computes the gradient of conv2d()'s outputs with respect to its kernel: for each tap, the sum over the
+* whole map of the input under that tap times the output gradient. Every thread sums its own contiguous
+* run of Hilbert-ordered tiles into a private kH x kW accumulator on its own cache lines, so threads never
+* contend, and the accumulators are then combined pairwise in a tree, in log2(threads) steps. Without
+* OpenMP, each run is a task on the pool or the set_conv2d_executor() executor instead. Each tile row's dot
+* products are vectorised in float, then added to the accumulators in double, so the error doesn't grow with
+* the size of the map. The static runs and the fixed tree make the result the same on every run with the
+* same number of threads, on either backend.
+* @param f             Pointer to the Feature Map of the forward pass.
+* @param H             Height of the Feature Map.
+* @param W             Width of the Feature Map.
+* @param grad_output   Pointer to the H x W gradient of the outputs.
+* @param kH            Height of the Kernel.
+* @param kW            Width of the Kernel.
+* @param w_padding     Width of the padding in the Feature Map.
+* @param h_padding     Height of the padding in the Feature Map.
+* @param grad_kernel   Pointer to the location where the kH x kW gradient of the Kernel is stored.
+*/
+int conv2d_weight_grad(float* f, int H, int W, float* grad_output, int kH, int kW, int w_padding, int h_padding, float* grad_kernel){
+
+    const int taps = kH * kW;
+
+    weight_grad_job job = { f, H, W, grad_output, kH, kW, w_padding, h_padding, NULL, 0, 0, NULL, 0 };
+    job.tile_count = build_tile_order(H, W, &job.tiles);
+    if (job.tile_count < 0) { return 1; }
+
+    // Each accumulator starts on its own cache line
+    const int thread_count = omp_get_max_threads();
+    job.stride = ((size_t)taps + 7) / 8 * 8;
+    if (posix_memalign((void**)&job.partials, 64, thread_count * job.stride * sizeof(double)) != 0){
+        free(job.tiles);
+        return 1;
+    }
+
+#ifdef _OPENMP
+    #pragma omp parallel num_threads(thread_count)
+    {
+        const int thread = omp_get_thread_num();
+        const int threads = omp_get_num_threads();
+        double* partial = job.partials + thread * job.stride;
+        for (int t = 0; t < taps; t++) { partial[t] = 0.0; }
+
+        const int first_tile = (int)((long long)job.tile_count * thread / threads);
+        const int last_tile = (int)((long long)job.tile_count * (thread + 1) / threads);
+        weight_grad_tiles(&job, first_tile, last_tile, partial);
+
+        // Tree reduction: at each step, every thread at a multiple of twice the step adds in its neighbour's
+        for (int step = 1; step < threads; step *= 2){
+            #pragma omp barrier
+            if (thread % (2 * step) == 0 && thread + step < threads){
+                const double* other = job.partials + (thread + step) * job.stride;
+                #pragma omp simd
+                for (int t = 0; t < taps; t++) { partial[t] += other[t]; }
+            }
+        }
+    }
+#else
+    // One task per thread, each with its own partial, combined afterwards in the same tree as above
+    job.task_count = thread_count;
+    if (external_executor != NULL){
+        external_executor(external_context, weight_grad_task, &job, job.task_count);
+    } else {
+        if (!pool.running && thread_pool_start(thread_count) != 0){
+            free(job.partials);
+            free(job.tiles);
+            return 1;
+        }
+        pool_execute(NULL, weight_grad_task, &job, job.task_count);
+    }
+
+    for (int step = 1; step < job.task_count; step *= 2){
+        for (int task = 0; task + step < job.task_count; task += 2 * step){
+            double* partial = job.partials + task * job.stride;
+            const double* other = job.partials + (task + step) * job.stride;
+            for (int t = 0; t < taps; t++) { partial[t] += other[t]; }
+        }
+    }
+#endif
+
+    for (int t = 0; t < taps; t++) { grad_kernel[t] = (float)job.partials[t]; }
+
+    free(job.partials);
+    free(job.tiles);
+    return 0;
+}
+
+
+/*
+Parses a -dtype name.
+@return     The DTYPE_ for the name, or -1 if it isn't recognised.
+*/
+int parse_dtype(const char* name){
+    if (strcmp(name, "fp32") == 0) { return DTYPE_FP32; }
+    if (strcmp(name, "fp16") == 0) { return DTYPE_FP16; }
+    if (strcmp(name, "bf16") == 0) { return DTYPE_BF16; }
+    return -1;
+}
+
+
+/*
+The size in bytes of one element of a DTYPE_, or 0 for an unknown type.
+*/
+size_t dtype_size(int dtype){
+    switch (dtype){
+        case DTYPE_FP32: return sizeof(float);
+        case DTYPE_FP16: return sizeof(uint16_t);
+        case DTYPE_BF16: return sizeof(uint16_t);
+    }
+    return 0;
+}
+
+
+/*
+Widens one fp16 or bf16 value to float, in software. Exact, since float can represent every such value.
+*/
+float half_to_float(uint16_t value, int dtype){
+
+    uint32_t bits;
+
+    if (dtype == DTYPE_BF16){
+        bits = (uint32_t)value << 16;
+    } else {
+        const uint32_t sign = (uint32_t)(value & 0x8000) << 16;
+        const uint32_t exponent = (value >> 10) & 0x1f;
+        const uint32_t mantissa = value & 0x3ff;
+
+        if (exponent == 0){
+            // Zero or subnormal: mantissa * 2^-24, which float holds exactly
+            const float magnitude = (float)mantissa * 5.9604644775390625e-8f;
+            return sign ? -magnitude : magnitude;
+        }
+        if (exponent == 31){
+            bits = sign | 0x7f800000 | (mantissa << 13);    // Infinity or NaN
+        } else {
+            bits = sign | ((exponent + 112) << 23) | (mantissa << 13);  // Rebias from 15 to 127
+        }
+    }
+
+    float result;
+    memcpy(&result, &bits, sizeof(result));
+    return result;
+}
+
+
+/*
+Narrows one float to fp16 or bf16 in software, rounding to nearest with ties to even, the same as the
+hardware conversions.
+*/
+uint16_t float_to_half(float value, int dtype){
+
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+
+    if (dtype == DTYPE_BF16){
+        if ((bits & 0x7fffffff) > 0x7f800000) { return (uint16_t)((bits >> 16) | 0x40); }  // Keep NaNs quiet
+        return (uint16_t)((bits + 0x7fff + ((bits >> 16) & 1)) >> 16);
+    }
+
+    const uint32_t sign = (bits >> 16) & 0x8000;
+    const uint32_t magnitude = bits & 0x7fffffff;
+
+    if (magnitude >= 0x7f800000) { return sign | 0x7c00 | (magnitude > 0x7f800000 ? 0x200 : 0); }   // Infinity or NaN
+    if (magnitude >= 0x477ff000) { return sign | 0x7c00; }      // 65520 and above round to infinity
+
+    if (magnitude < 0x38800000){
+        // Below the smallest normal fp16 (2^-14), so the result is subnormal: a count of 2^-24 steps
+        const uint32_t exponent = magnitude >> 23;
+        if (exponent < 102) { return sign; }
+
+        const uint32_t mantissa = (magnitude & 0x7fffff) | 0x800000;
+        const uint32_t shift = 126 - exponent;
+        const uint32_t remainder = mantissa & ((1u << shift) - 1);
+        const uint32_t halfway = 1u << (shift - 1);
+        uint32_t result = mantissa >> shift;
+        if (remainder > halfway || (remainder == halfway && (result & 1))) { result++; }
+        return sign | result;
+    }
+
+    // Normal: rebias the exponent from 127 to 15, then round away the low 13 mantissa bits.
+    // A carry out of the mantissa correctly bumps the exponent.
+    uint32_t result = (magnitude - 0x38000000) >> 13;
+    const uint32_t remainder = magnitude & 0x1fff;
+    if (remainder > 0x1000 || (remainder == 0x1000 && (result & 1))) { result++; }
+    return sign | result;
+}
+
+
+/*
+Widens an array of fp16 or bf16 values to float. Uses F16C for fp16 when the compiler targets it; bf16 is
+a shift, which vectorises anywhere.
+@param src      The values to widen.
+@param dst      The location where the floats will be stored.
+@param count    The number of values.
+@param dtype    DTYPE_FP16 or DTYPE_BF16.
+*/
+void convert_half_to_float(const uint16_t* src, float* dst, size_t count, int dtype){
+
+    size_t i = 0;
+
+    if (dtype == DTYPE_BF16){
+        #pragma omp simd
+        for (size_t j = 0; j < count; j++){
+            const uint32_t bits = (uint32_t)src[j] << 16;
+            memcpy(&dst[j], &bits, sizeof(float));
+        }
+        return;
+    }
+
+#ifdef __F16C__
+    for (; i + 8 <= count; i += 8){
+        _mm256_storeu_ps(dst + i, _mm256_cvtph_ps(_mm_loadu_si128((const __m128i*)(src + i))));
+    }
+#endif
+    for (; i < count; i++){
+        dst[i] = half_to_float(src[i], dtype);
+    }
+}
+
+
+/*
+Narrows an array of floats to fp16 or bf16, rounding to nearest even. Uses F16C for fp16 and AVX-512 BF16
+for bf16 when the compiler targets them. Note that the AVX-512 BF16 conversion flushes float subnormals
+to zero, while the software path keeps them.
+@param src      The floats to narrow.
+@param dst      The location where the 16-bit values will be stored.
+@param count    The number of values.
+@param dtype    DTYPE_FP16 or DTYPE_BF16.
+*/
+void convert_float_to_half(const float* src, uint16_t* dst, size_t count, int dtype){
+
+    size_t i = 0;
+
+    if (dtype == DTYPE_BF16){
+#ifdef __AVX512BF16__
+        for (; i + 16 <= count; i += 16){
+            const __m256bh narrowed = _mm512_cvtneps_pbh(_mm512_loadu_ps(src + i));
+            _mm256_storeu_si256((__m256i*)(dst + i), (__m256i)narrowed);
+        }
+#endif
+        #pragma omp simd
+        for (size_t j = i; j < count; j++){
+            dst[j] = float_to_half(src[j], dtype);
+        }
+        return;
+    }
+
+#ifdef __F16C__
+    for (; i + 8 <= count; i += 8){
+        const __m128i narrowed = _mm256_cvtps_ph(_mm256_loadu_ps(src + i), _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+        _mm_storeu_si128((__m128i*)(dst + i), narrowed);
+    }
+#endif
+    for (; i < count; i++){
+        dst[i] = float_to_half(src[i], dtype);
+    }
+}
+
+
+/* 
+* Performs parallel 2D discrete convolutions on fp16 or bf16 data, accumulating in float. Halves the
+* bytes read and written compared with float storage; the kernel stays in float.
+* Each thread widens one kernel row's worth of input at a time into an L1-resident block, applies that
+* row's taps to a block of float accumulators, and narrows the finished block on store.
+* @param f             Pointer to the padded Feature Map, in fp16 or bf16.
+* @param H             Height of the Feature Map.
+* @param W             Width of the Feature Map.
+* @param g             Pointer to the Kernel, in float.
+* @param kH            Height of the Kernel.
+* @param kW            Width of the Kernel.
+* @param w_padding     Width of the padding in the Feature Map.
+* @param h_padding     Height of the padding in the Feature Map.
+* @param output        Pointer to the location where outputs are stored, in the same type as f.
+* @param dtype         DTYPE_FP16 or DTYPE_BF16.
+*/
+int half_conv2d(uint16_t* f, int H, int W, float* g, int kH, int kW, int w_padding, int h_padding, uint16_t* output, int dtype){
+
+    const int total_width = W + w_padding*2;
+
+    // dimensions for convolution window
+    const int M = (kH - 1) / 2;
+    const int N = (kW - 1) / 2;
+
+    int failed = 0;
+
+    #pragma omp parallel reduction(|:failed)
+    {
+        // Per-thread scratch: float accumulators for one block, and the widened input it needs, with its halo
+        float* accumulators = NULL;
+        float* widened = NULL;
+        failed = posix_memalign((void**)&accumulators, 64, HALF_BLOCK * sizeof(float)) != 0 ||
+            posix_memalign((void**)&widened, 64, (HALF_BLOCK + kW) * sizeof(float)) != 0;
+
+        #pragma omp for schedule(static)
+        for (int n = h_padding; n < H + h_padding; n++){
+            for (int block = 0; block < W && !failed; block += HALF_BLOCK){
+
+                const int block_width = min(HALF_BLOCK, W - block);
+
+                for (int k = 0; k < block_width; k++){
+                    accumulators[k] = 0.0f;
+                }
+
+                for (int i = 0; i < kH; i++){
+                    convert_half_to_float(f + IDX(n + i - M, block + w_padding - N, total_width), widened, block_width + kW - 1, dtype);
+
+                    for (int j = 0; j < kW; j++){
+                        const float weight = g[IDX(i, j, kW)];
+
+                        #pragma omp simd
+                        for (int k = 0; k < block_width; k++){
+                            accumulators[k] += widened[k + j] * weight;
+                        }
+                    }
+                }
+
+                convert_float_to_half(accumulators, output + IDX(n - h_padding, block, W), block_width, dtype);
+            }
+        }
+
+        free(accumulators);
+        free(widened);
+    }
+    return failed;
+}
+
+
+/*
+The quantized types used by -quant, or -1 for an unknown name.
+*/
+int parse_quant(const char* name){
+    if (strcmp(name, "int8") == 0) { return QUANT_INT8; }
+    if (strcmp(name, "int16") == 0) { return QUANT_INT16; }
+    return -1;
+}
+
+
+/*
+The smallest and largest values of a QTYPE_.
+*/
+void quant_range(int qtype, int* qmin, int* qmax){
+    switch (qtype){
+        case QTYPE_UINT8: *qmin = 0; *qmax = 255; return;
+        case QTYPE_INT8: *qmin = -127; *qmax = 127; return;      // -128 is left out so the range is symmetric
+        case QTYPE_INT16: *qmin = -32768; *qmax = 32767; return;
+    }
+    *qmin = *qmax = 0;
+}
+
+
+/*
+Chooses a scale and zero point that map [lo, hi] onto [qmin, qmax]. The range is widened to include zero,
+so that zero (the padding) is represented exactly.
+*/
+quant_params choose_quant_params(float lo, float hi, int qmin, int qmax){
+
+    lo = min(lo, 0.0f);
+    hi = max(hi, 0.0f);
+
+    quant_params params = {1.0f, 0};
+    if (hi > lo) { params.scale = (hi - lo) / (float)(qmax - qmin); }
+    params.zero_point = (int)lrintf(qmin - lo / params.scale);
+    params.zero_point = max(qmin, min(qmax, params.zero_point));
+    return params;
+}
+
+
+/*
+Quantizes an array of floats, rounding to nearest and saturating.
+@param src      The floats to quantize.
+@param dst      The location where the quantized values will be stored, as a QTYPE_ array.
+@param count    The number of values.
+@param params   The scale and zero point to use.
+@param qtype    QTYPE_UINT8, QTYPE_INT8 or QTYPE_INT16.
+*/
+void quantize_array(const float* src, void* dst, size_t count, quant_params params, int qtype){
+
+    int qmin, qmax;
+    quant_range(qtype, &qmin, &qmax);
+    const float inverse = 1.0f / params.scale;
+
+    #pragma omp simd
+    for (size_t i = 0; i < count; i++){
+        int value = (int)nearbyintf(src[i] * inverse) + params.zero_point;
+        value = max(qmin, min(qmax, value));
+
+        switch (qtype){
+            case QTYPE_UINT8: ((uint8_t*)dst)[i] = (uint8_t)value; break;
+            case QTYPE_INT8: ((int8_t*)dst)[i] = (int8_t)value; break;
+            case QTYPE_INT16: ((int16_t*)dst)[i] = (int16_t)value; break;
+        }
+    }
+}
+
+
+/*
+Converts an array of quantized values back to float.
+@param src      The QTYPE_ array to dequantize.
+@param dst      The location where the floats will be stored.
+@param count    The number of values.
+@param params   The scale and zero point the values were quantized with.
+@param qtype    QTYPE_UINT8, QTYPE_INT8 or QTYPE_INT16.
+*/
+void dequantize_array(const void* src, float* dst, size_t count, quant_params params, int qtype){
+
+    #pragma omp parallel for schedule(static)
+    for (size_t i = 0; i < count; i++){
+        int value = 0;
+        switch (qtype){
+            case QTYPE_UINT8: value = ((const uint8_t*)src)[i]; break;
+            case QTYPE_INT8: value = ((const int8_t*)src)[i]; break;
+            case QTYPE_INT16: value = ((const int16_t*)src)[i]; break;
+        }
+        dst[i] = params.scale * (float)(value - params.zero_point);
+    }
+}
+
+
+/*
+Chooses the quantization parameters for a convolution, from the ranges of its float inputs.
+The feature map gets an asymmetric scale over its own range, and the kernel a symmetric one, so the kernel
+zero point is 0 and only the feature zero point needs correcting for. The output range is the exact bound
+of what the convolution can produce from those inputs, so requantization never clips.
+For int16, the kernel is given fewer bits when needed to keep sum(|kernel|) * 32768 inside an int32, so
+the accumulators can't overflow.
+@param f            Pointer to the padded float Feature Map.
+@param H            Height of the Feature Map.
+@param W            Width of the Feature Map.
+@param g            Pointer to the float Kernel.
+@param kH           Height of the Kernel.
+@param kW           Width of the Kernel.
+@param w_padding    Width of the padding in the Feature Map.
+@param h_padding    Height of the padding in the Feature Map.
+@param quant        QUANT_INT8 or QUANT_INT16.
+@param config       The location where the parameters will be stored.
+@return             0 on success, or 1 if the kernel has too many taps for int32 accumulation.
+*/
+int prepare_quantization(float* f, int H, int W, float* g, int kH, int kW, int w_padding, int h_padding, int quant, quant_config* config){
+
+    const int total_width = W + w_padding*2;
+    const int taps = kH * kW;
+
+    config->quant = quant;
+    config->feature_type = quant == QUANT_INT8 ? QTYPE_UINT8 : QTYPE_INT16;
+    config->kernel_type = quant == QUANT_INT8 ? QTYPE_INT8 : QTYPE_INT16;
+
+    // vpdpbusd sums groups of 4 byte products, and vpdpwssd pairs of word products, into each int32 lane
+    const int group = quant == QUANT_INT8 ? 4 : 2;
+    config->padded_kW = (kW + group - 1) / group * group;
+
+    // Feature map range
+    float f_lo = 0.0f, f_hi = 0.0f;
+    #pragma omp parallel for schedule(static) reduction(min:f_lo) reduction(max:f_hi)
+    for (int i = h_padding; i < H + h_padding; i++){
+        for (int j = w_padding; j < W + w_padding; j++){
+            f_lo = min(f_lo, f[IDX(i, j, total_width)]);
+            f_hi = max(f_hi, f[IDX(i, j, total_width)]);
+        }
+    }
+
+    // Kernel range, and the sum of its magnitudes, which bounds the accumulators
+    float g_max = 0.0f, g_sum = 0.0f;
+    for (int i = 0; i < taps; i++){
+        g_max = max(g_max, fabsf(g[i]));
+        g_sum += fabsf(g[i]);
+    }
+
+    int f_min, f_max, g_qmin, g_qmax;
+    quant_range(config->feature_type, &f_min, &f_max);
+    quant_range(config->kernel_type, &g_qmin, &g_qmax);
+
+    if (quant == QUANT_INT8){
+        if ((long long)taps * 255 * 127 > INT32_MAX) { return 1; }
+    } else {
+        // Rounding adds at most 1/2 per tap to sum(|q|), so leave room for it
+        if (taps >= 65535) { return 1; }
+        if (g_sum > 0.0f) { g_qmax = min(g_qmax, max(1, (int)((65535 - taps) * (g_max / g_sum)))); }
+        g_qmin = -g_qmax;
+    }
+
+    config->feature = choose_quant_params(f_lo, f_hi, f_min, f_max);
+    config->kernel = choose_quant_params(-g_max, g_max, g_qmin, g_qmax);
+
+    // The extremes of each product are at the ends of the representable feature range
+    const float rep_lo = config->feature.scale * (f_min - config->feature.zero_point);
+    const float rep_hi = config->feature.scale * (f_max - config->feature.zero_point);
+    float out_lo = 0.0f, out_hi = 0.0f;
+    for (int i = 0; i < taps; i++){
+        out_lo += min(g[i] * rep_lo, g[i] * rep_hi);
+        out_hi += max(g[i] * rep_lo, g[i] * rep_hi);
+    }
+    config->output = choose_quant_params(out_lo, out_hi, f_min, f_max);
+    return 0;
+}
+
+
+/*
+Quantizes a float kernel into kH rows of padded_kW taps, with the extra taps set to zero.
+Also stores the sum of the quantized taps, which the feature zero point correction needs.
+*/
+void quantize_kernel(float* g, int kH, int kW, void* quantized, quant_config* config){
+
+    const size_t element = config->kernel_type == QTYPE_INT8 ? sizeof(int8_t) : sizeof(int16_t);
+    memset(quantized, 0, (size_t)kH * config->padded_kW * element);
+
+    config->kernel_sum = 0;
+    for (int i = 0; i < kH; i++){
+        char* row = (char*)quantized + (size_t)i * config->padded_kW * element;
+        quantize_array(g + IDX(i, 0, kW), row, kW, config->kernel, config->kernel_type);
+        for (int j = 0; j < kW; j++){
+            config->kernel_sum += element == 1 ? ((int8_t*)row)[j] : ((int16_t*)row)[j];
+        }
+    }
+}
+
+
+/*
+Adds one kernel row's uint8 x int8 products into a block of int32 accumulators. With AVX-512 VNNI, each
+vpdpbusd applies 4 taps to 16 outputs, after a byte permute gathers every output's 4 overlapping inputs
+into its lane. Otherwise the compiler vectorises the plain loop.
+@param f        The inputs under the first tap of the first output.
+@param g        padded_kW int8 taps, a multiple of 4.
+@param taps     padded_kW.
+@param acc      The accumulators to add to.
+@param width    The number of outputs in the block.
+*/
+void quantized_row_int8(const uint8_t* f, const int8_t* g, int taps, int32_t* acc, int width){
+
+    int k = 0;
+
+#if defined(__AVX512VNNI__) && defined(__AVX512VBMI__)
+    // Byte b of lane l takes input l + b
+    uint8_t order[64];
+    for (int b = 0; b < 64; b++) { order[b] = (uint8_t)(b / 4 + b % 4); }
+    const __m512i windows = _mm512_loadu_si512(order);
+
+    for (; k + 16 <= width; k += 16){
+        __m512i sum = _mm512_loadu_si512(acc + k);
+        for (int j = 0; j < taps; j += 4){
+            int32_t weights;
+            memcpy(&weights, g + j, sizeof(weights));
+
+            // Only the 19 bytes used are loaded, so this never reads past the inputs
+            const __m512i inputs = _mm512_maskz_loadu_epi8(0x7ffff, f + k + j);
+            sum = _mm512_dpbusd_epi32(sum, _mm512_permutexvar_epi8(windows, inputs), _mm512_set1_epi32(weights));
+        }
+        _mm512_storeu_si512(acc + k, sum);
+    }
+#endif
+
+    for (int j = 0; j < taps; j++){
+        const int32_t weight = g[j];
+
+        #pragma omp simd
+        for (int m = k; m < width; m++){
+            acc[m] += (int32_t)f[m + j] * weight;
+        }
+    }
+}
+
+
+/*
+Adds one kernel row's int16 x int16 products into a block of int32 accumulators. With AVX-512 VNNI, each
+vpdpwssd applies 2 taps to 16 outputs; otherwise the compiler vectorises the plain loop (as pmaddwd).
+@param f        The inputs under the first tap of the first output.
+@param g        padded_kW int16 taps, a multiple of 2.
+@param taps     padded_kW.
+@param acc      The accumulators to add to.
+@param width    The number of outputs in the block.
+*/
+void quantized_row_int16(const int16_t* f, const int16_t* g, int taps, int32_t* acc, int width){
+
+    int k = 0;
+
+#if defined(__AVX512VNNI__) && defined(__AVX512BW__)
+    // Word w of lane l takes input l + w
+    int16_t order[32];
+    for (int w = 0; w < 32; w++) { order[w] = (int16_t)(w / 2 + w % 2); }
+    const __m512i windows = _mm512_loadu_si512(order);
+
+    for (; k + 16 <= width; k += 16){
+        __m512i sum = _mm512_loadu_si512(acc + k);
+        for (int j = 0; j < taps; j += 2){
+            int32_t weights;
+            memcpy(&weights, g + j, sizeof(weights));
+
+            const __m512i inputs = _mm512_maskz_loadu_epi16(0x1ffff, f + k + j);
+            sum = _mm512_dpwssd_epi32(sum, _mm512_permutexvar_epi16(windows, inputs), _mm512_set1_epi32(weights));
+        }
+        _mm512_storeu_si512(acc + k, sum);
+    }
+#endif
+
+    for (int j = 0; j < taps; j++){
+        const int32_t weight = g[j];
+
+        #pragma omp simd
+        for (int m = k; m < width; m++){
+            acc[m] += (int32_t)f[m + j] * weight;
+        }
+    }
+}
+
+
+/* 
+* Performs parallel 2D discrete convolutions on quantized data: uint8 x int8 (int8) or int16 x int16 (int16)
+* products, accumulated exactly in int32, then requantized to the output scale and zero point.
+* Like half_conv2d(), each thread works through blocks of output columns that stay in L1.
+* @param f             Pointer to the padded, quantized Feature Map. Its padding must hold the feature
+*                      zero point, and it needs padded_kW - kW elements of readable slack after its end.
+* @param H             Height of the Feature Map.
+* @param W             Width of the Feature Map.
+* @param g             Pointer to the quantized Kernel, from quantize_kernel().
+* @param kH            Height of the Kernel.
+* @param kW            Width of the Kernel.
+* @param w_padding     Width of the padding in the Feature Map.
+* @param h_padding     Height of the padding in the Feature Map.
+* @param output        Pointer to the location where quantized outputs are stored, in the feature map's type.
+* @param config        The quantization parameters, from prepare_quantization().
+*/
+int quantized_conv2d(void* f, int H, int W, void* g, int kH, int kW, int w_padding, int h_padding, void* output, const quant_config* config){
+
+    const int total_width = W + w_padding*2;
+    const int taps = config->padded_kW;
+
+    // dimensions for convolution window
+    const int M = (kH - 1) / 2;
+    const int N = (kW - 1) / 2;
+
+    int qmin, qmax;
+    quant_range(config->feature_type, &qmin, &qmax);
+
+    // sum((q_f - z_f) * q_g) = sum(q_f * q_g) - z_f * sum(q_g), and the kernel zero point is 0.
+    // Folding the correction and the output zero point into one offset leaves a single fma per output.
+    const float multiplier = config->feature.scale * config->kernel.scale / config->output.scale;
+    const float offset = config->output.zero_point - multiplier * (float)config->feature.zero_point * (float)config->kernel_sum;
+
+    int failed = 0;
+
+    #pragma omp parallel reduction(|:failed)
+    {
+        int32_t* accumulators = NULL;
+        failed = posix_memalign((void**)&accumulators, 64, QUANT_BLOCK * sizeof(int32_t)) != 0;
+
+        #pragma omp for schedule(static)
+        for (int n = h_padding; n < H + h_padding; n++){
+            for (int block = 0; block < W && !failed; block += QUANT_BLOCK){
+
+                const int block_width = min(QUANT_BLOCK, W - block);
+                memset(accumulators, 0, block_width * sizeof(int32_t));
+
+                for (int i = 0; i < kH; i++){
+                    const size_t start = IDX(n + i - M, block + w_padding - N, total_width);
+                    if (config->quant == QUANT_INT8){
+                        quantized_row_int8((uint8_t*)f + start, (int8_t*)g + IDX(i, 0, taps), taps, accumulators, block_width);
+                    } else {
+                        quantized_row_int16((int16_t*)f + start, (int16_t*)g + IDX(i, 0, taps), taps, accumulators, block_width);
+                    }
+                }
+
+                // Requantize
+                const size_t first = IDX(n - h_padding, block, W);
+                #pragma omp simd
+                for (int k = 0; k < block_width; k++){
+                    int value = (int)nearbyintf(fmaf((float)accumulators[k], multiplier, offset));
+                    value = max(qmin, min(qmax, value));
+                    if (config->quant == QUANT_INT8){
+                        ((uint8_t*)output)[first + k] = (uint8_t)value;
+                    } else {
+                        ((int16_t*)output)[first + k] = (int16_t)value;
+                    }
+                }
+            }
+        }
+
+        free(accumulators);
+    }
+    return failed;
+}
+
+
+/*
+Compares dequantized outputs with the float outputs of conv2d(), printing the error statistics.
+@param reference    The H x W float outputs.
+@param output       The H x W dequantized outputs.
+@param count        The number of outputs.
+@param config       The quantization parameters, for the output step size.
+*/
+int report_quantization_error(float* reference, float* output, size_t count, const quant_config* config){
+
+    double max_error = 0.0, squared_error = 0.0, squared_signal = 0.0;
+    size_t worst = 0;
+
+    for (size_t i = 0; i < count; i++){
+        const double error = fabs((double)output[i] - reference[i]);
+        if (error > max_error) { max_error = error; worst = i; }
+        squared_error += error * error;
+        squared_signal += (double)reference[i] * reference[i];
+    }
+
+    const double rms = sqrt(squared_error / count);
+    printf("Quantized %s error against the float conv2d() (%zu outputs):\n", config->quant == QUANT_INT8 ? "int8" : "int16", count);
+    printf("    output scale            %.3e, zero point %d\n", config->output.scale, config->output.zero_point);
+    printf("    max absolute error      %.3e (%.2f output steps, at output %zu)\n", max_error, max_error / config->output.scale, worst);
+    printf("    RMS error               %.3e\n", rms);
+    if (squared_error > 0.0) { printf("    SQNR                    %.1f dB\n", 10.0 * log10(squared_signal / squared_error)); }
+    return 0;
+}
+
+
+/*
+Writes outputs to a file.
+@param filepath         The filepath of where to find/put the output file.
+@param outputs          A 2d array of float32s. This is what is written to the file for serial convolutions.
+@param padded_outputs   A padded 2d array of float32s. This is written to the file, instead of `outputs`, when outputting data from a parallel convolution.
+@param h_dimension      The height of the outputs. Should be the same as the feature map.
+@param w_dimension      The width of the outputs. Should be the same as the feature map.
+*/
+int write_data_to_file(char* filepath, float* outputs, float_array padded_outputs, int h_dimension, int w_dimension, int h_padding, int w_padding){
+    if (filepath == NULL){ return 1; }
+    FILE* file_ptr = fopen(filepath, "w");
+    if (file_ptr == NULL){ return 1; }
+
+    // Empty the file, then close it.
+    fclose(file_ptr);
+
+    // Reopen file in append mode
+    file_ptr = fopen(filepath, "a");
+
+    // Append the dimensions to the file
+    fprintf(file_ptr, "%d %d\n", h_dimension, w_dimension);
+    
+    for (int i = h_padding; i < h_dimension + h_padding; i++){
+        for (int j = w_padding; j < w_dimension + w_padding; j++){
+
+            // Depending if paralleism is enabled or not, print the outputs
+            if (outputs != NULL){
+                fprintf(file_ptr, "%.3f ", outputs[IDX(i, j, w_dimension + 2 * w_padding)]);
+            } else if (padded_outputs.arr != NULL){
+                fprintf(file_ptr, "%.3f ", padded_outputs.arr[IDX(i-h_padding, j-w_padding, w_dimension)]);
+            } else { return 1; }
+            
+        }
+        fprintf(file_ptr, "\n");
+    }
+
+    fclose(file_ptr);
+
+    return 0;
+
+}
+
+
+/*
+Generates a 2d array of random floats into the interior of a padded array, leaving the padding as zeroes.
+Rows are split with the same static partition that parallel_conv2d() uses, so every page is first
+touched by the thread that later reads it.
+@param height           The height of the data, excluding padding.
+@param width            The width of the data, excluding padding.
+@param padding_height   The number of rows of zeroes above and below the data.
+@param padding_width    The number of columns of zeroes left and right of the data.
+@param output           The location where the generated data will be stored.
+*/
+int generate_data(int height, int width, int padding_height, int padding_width, float* *output){
+
+    // Make a new random seed. This stops f from being the same as g when the code runs too fast.
+    return generate_rows((unsigned int)rand(), 0, height, width, padding_height, padding_width, output);
+}
+
+
+/*
+Generates rows [first_row, first_row + height) of the map that generate_data() would make from the given
+seed. Each row is seeded from the seed and its own index, so the data does not depend on the number of
+threads, and any band of a map can be regenerated on its own.
+@param seed             The map's seed.
+@param first_row        The index of the first row to generate, within the whole map.
+@param height           The number of rows to generate, excluding padding.
+@param width            The width of the data, excluding padding.
+@param padding_height   The number of rows of zeroes above and below the data.
+@param padding_width    The number of columns of zeroes left and right of the data.
+@param output           The location where the generated data will be stored.
+*/
+int generate_rows(unsigned int seed, int first_row, int height, int width, int padding_height, int padding_width, float* *output){
+
+    const int total_width = width + padding_width*2;
+    const int total_height = height + padding_height*2;
+
+    #pragma omp parallel for schedule(static)
+    for (int i = 0; i < height; i++){
+
+        // The owners of the first and last rows also touch the padding rows next to them
+        if (i == 0){
+            memset(*output, 0, (size_t)padding_height * total_width * sizeof(float));
+        }
+        if (i == height - 1){
+            memset(*output + IDX(total_height - padding_height, 0, total_width), 0, (size_t)padding_height * total_width * sizeof(float));
+        }
+
+        float* row = *output + IDX(i + padding_height, 0, total_width);
+        unsigned int row_seed = seed + (unsigned int)(first_row + i) * 2654435761u;
+
+        for (int j = 0; j < padding_width; j++){
+            row[j] = 0.0f;
+            row[total_width - 1 - j] = 0.0f;
+        }
+        for (int j = padding_width; j < total_width - padding_width; j++){
+            row[j] = (float)rand_r(&row_seed) / (float)RAND_MAX;
+        }
+    }
+    return 0;
+}
+
+
+/*
+Fills a padded 2d array with zeroes, using the same static row partition as generate_data().
+@param height           The height of the data, excluding padding.
+@param width            The width of the data, excluding padding.
+@param padding_height   The number of rows of padding above and below the data.
+@param padding_width    The number of columns of padding left and right of the data.
+@param output           The array to be filled.
+*/
+int zero_data(int height, int width, int padding_height, int padding_width, float* *output){
+
+    const int total_width = width + padding_width*2;
+    const int total_height = height + padding_height*2;
+
+    #pragma omp parallel for schedule(static)
+    for (int i = 0; i < height; i++){
+        if (i == 0){
+            memset(*output, 0, (size_t)padding_height * total_width * sizeof(float));
+        }
+        if (i == height - 1){
+            memset(*output + IDX(total_height - padding_height, 0, total_width), 0, (size_t)padding_height * total_width * sizeof(float));
+        }
+        memset(*output + IDX(i + padding_height, 0, total_width), 0, (size_t)total_width * sizeof(float));
+    }
+    return 0;
+}
+
+
+/*
+Makes sure a buffer can hold at least `count` floats, only reallocating when it needs to grow.
+The contents are not preserved when the buffer grows.
+@param buffer       The buffer to reserve.
+@param count        The number of floats needed.
+@param page_mode    One of the PAGES_ modes. Huge pages are only used for buffers of at least HUGE_PAGE_SIZE.
+*/
+int reserve_buffer(float_buffer* buffer, size_t count, int page_mode){
+
+    if (buffer->arr != NULL && buffer->capacity >= count){ return 0; }
+
+    release_buffer(buffer);
+
+    const size_t bytes = count * sizeof(float);
+    if (bytes < HUGE_PAGE_SIZE) { page_mode = PAGES_DEFAULT; }
+    const size_t huge_bytes = (bytes + HUGE_PAGE_SIZE - 1) / HUGE_PAGE_SIZE * HUGE_PAGE_SIZE;
+
+    // Explicit huge pages need a reserved pool (vm.nr_hugepages), so fall back to transparent ones without it
+    if (page_mode == PAGES_HUGETLB){
+        void* mapped = mmap(NULL, huge_bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (mapped != MAP_FAILED){
+            buffer->arr = (float*)mapped;
+            buffer->mapped_bytes = huge_bytes;
+        } else {
+            page_mode = PAGES_TRANSPARENT;
+        }
+    }
+
+    if (page_mode == PAGES_TRANSPARENT){
+        // Aligning to the huge page size lets the kernel back the whole buffer with 2 MB pages
+        if (posix_memalign((void**)&buffer->arr, HUGE_PAGE_SIZE, huge_bytes) != 0){
+            buffer->arr = NULL;
+            return 1;
+        }
+        madvise(buffer->arr, huge_bytes, MADV_HUGEPAGE);
+    }
+
+    if (page_mode == PAGES_DEFAULT){
+        if (posix_memalign((void**)&buffer->arr, 64, bytes) != 0){
+            buffer->arr = NULL;
+            return 1;
+        }
+    }
+    buffer->capacity = count;
+
+    // Fault every huge page in now, in parallel, so the cost never lands inside a timed region.
+    // Contiguous static chunks keep the pages roughly where the row partitions will touch them.
+    if (page_mode != PAGES_DEFAULT){
+        char* bytes_ptr = (char*)buffer->arr;
+        const long pages = (long)(huge_bytes / HUGE_PAGE_SIZE);
+
+        #pragma omp parallel for schedule(static)
+        for (long page = 0; page < pages; page++){
+            memset(bytes_ptr + page * HUGE_PAGE_SIZE, 0, HUGE_PAGE_SIZE);
+        }
+    }
+    return 0;
+}
+
+
+/*
+Frees a buffer and resets it to empty.
+@param buffer   The buffer to release.
+*/
+void release_buffer(float_buffer* buffer){
+    if (buffer->mapped_bytes != 0){
+        munmap(buffer->arr, buffer->mapped_bytes);
+    } else {
+        free(buffer->arr);
+    }
+    buffer->arr = NULL;
+    buffer->capacity = 0;
+    buffer->mapped_bytes = 0;
+}
+
+
+/*
+Prints the page size the kernel actually used for an array, read from /proc/self/smaps.
+@param name     The name to print for the array.
+@param arr      Any address inside the array.
+*/
+int report_page_size(const char* name, void* arr){
+
+    FILE* file_ptr = fopen("/proc/self/smaps", "r");
+    if (file_ptr == NULL){
+        printf("%s: page size unavailable.\n", name);
+        return 1;
+    }
+
+    const unsigned long address = (unsigned long)arr;
+    char line[512];
+    int in_mapping = 0;
+    long size_kb = -1, page_kb = -1, thp_kb = -1;
+
+    while (fgets(line, sizeof(line), file_ptr) != NULL){
+        unsigned long start, end;
+
+        // Each mapping starts with a "start-end perms ..." line, followed by "Field: value kB" lines
+        if (sscanf(line, "%lx-%lx ", &start, &end) == 2){
+            if (in_mapping) { break; }
+            in_mapping = address >= start && address < end;
+            continue;
+        }
+        if (!in_mapping) { continue; }
+
+        sscanf(line, "Size: %ld kB", &size_kb);
+        sscanf(line, "KernelPageSize: %ld kB", &page_kb);
+        sscanf(line, "AnonHugePages: %ld kB", &thp_kb);
+    }
+    fclose(file_ptr);
+
+    if (page_kb < 0){
+        printf("%s: page size unavailable.\n", name);
+        return 1;
+    }
+    if (thp_kb > 0){
+        printf("%s: %ld kB pages, %ld of %ld kB backed by transparent huge pages.\n", name, page_kb, thp_kb, size_kb);
+    } else {
+        printf("%s: %ld kB pages.\n", name, page_kb);
+    }
+    return 0;
+}
+
+
+/*
+Reads the ids of the online NUMA nodes. The ids needn't be contiguous: the range list may be "0", "0-1",
+"0,2" or "0-1,3". Falls back to node 0 alone if the topology can't be read.
+@param node_ids     The array, MAX_NUMA_NODES long, into which the node ids will be stored in order.
+@return             The number of online nodes, at least 1.
+*/
+int read_numa_nodes(int* node_ids){
+
+    node_ids[0] = 0;
+    FILE* file_ptr = fopen(NUMA_SYSFS_PATH "/online", "r");
+    if (file_ptr == NULL){ return 1; }
+
+    char line[1024];
+    if (fgets(line, sizeof(line), file_ptr) == NULL){ fclose(file_ptr); return 1; }
+    fclose(file_ptr);
+
+    int nodes = 0;
+    char* save = NULL;
+    char* token = strtok_r(line, ",\n", &save);
+    while (token != NULL){
+        int first = 0, last = 0;
+        int matched = sscanf(token, "%d-%d", &first, &last);
+        if (matched == 1) { last = first; }
+        for (int node = first; matched >= 1 && node <= last && nodes < MAX_NUMA_NODES; node++){
+            node_ids[nodes++] = node;
+        }
+        token = strtok_r(NULL, ",\n", &save);
+    }
+
+    if (nodes == 0) { node_ids[0] = 0; }
+    return max(nodes, 1);
+}
+
+
+/*
+Reads the list of CPUs belonging to a NUMA node, e.g. "0-3,8-11".
+@param node     The NUMA node to read.
+@param cpus     The set into which the node's CPUs will be stored.
+@return         The number of CPUs found, or 0 if the node couldn't be read.
+*/
+int read_node_cpus(int node, cpu_set_t* cpus){
+
+    char path[128];
+    snprintf(path, sizeof(path), NUMA_SYSFS_PATH "/node%d/cpulist", node);
+
+    CPU_ZERO(cpus);
+    FILE* file_ptr = fopen(path, "r");
+    if (file_ptr == NULL){ return 0; }
+
+    char line[1024];
+    if (fgets(line, sizeof(line), file_ptr) == NULL){ fclose(file_ptr); return 0; }
+    fclose(file_ptr);
+
+    // pin_threads_to_nodes() calls this from every thread at once, so the tokenizer must be reentrant
+    char* save = NULL;
+    char* token = strtok_r(line, ",\n", &save);
+    while (token != NULL){
+        int first = 0, last = 0;
+        int matched = sscanf(token, "%d-%d", &first, &last);
+        if (matched == 1) { last = first; }
+        for (int cpu = first; matched >= 1 && cpu <= last; cpu++){
+            CPU_SET(cpu, cpus);
+        }
+        token = strtok_r(NULL, ",\n", &save);
+    }
+    return CPU_COUNT(cpus);
+}
+
+
+/*
+Pins each OpenMP thread to one CPU, grouping consecutive threads on the same NUMA node. Combined with the
+static row partitions, this gives each node a contiguous band of feature map and output rows.
+@param node_ids     The ids of the NUMA nodes to spread the threads over, from read_numa_nodes().
+@param nodes        The number of NUMA nodes.
+@return             0 on success, or 1 if any thread could not be pinned.
+*/
+int pin_threads_to_nodes(const int* node_ids, int nodes){
+
+    int failed = 0;
+
+    #pragma omp parallel reduction(|:failed)
+    {
+        const int thread = omp_get_thread_num();
+        const int team_size = omp_get_num_threads();
+
+        // Consecutive threads share a node, the same way the static schedule hands out consecutive rows
+        const int node = (int)(((long)thread * nodes) / team_size);
+        const int first_thread = (int)(((long)node * team_size + nodes - 1) / nodes);
+
+        cpu_set_t node_cpus;
+        const int cpu_count = read_node_cpus(node_ids[node], &node_cpus);
+
+        if (cpu_count == 0){
+            failed = 1;
+        } else {
+            // Pick the n-th CPU of the node, wrapping around if the node is oversubscribed
+            int target = (thread - first_thread) % cpu_count;
+            cpu_set_t mask;
+            CPU_ZERO(&mask);
+            for (int cpu = 0; cpu < CPU_SETSIZE; cpu++){
+                if (CPU_ISSET(cpu, &node_cpus) && target-- == 0){
+                    CPU_SET(cpu, &mask);
+                    break;
+                }
+            }
+            failed = sched_setaffinity(0, sizeof(mask), &mask) != 0;
+        }
+    }
+    return failed;
+}
+
+
+/*
+Prints which NUMA nodes the pages of an array actually landed on, split into one row band per node.
+@param name         The name to print for the array.
+@param arr          The array to inspect.
+@param height       The number of rows in the array.
+@param width        The number of elements in each row.
+@param node_ids     The ids of the NUMA nodes, from read_numa_nodes(). Band b is expected on node_ids[b].
+@param nodes        The number of NUMA nodes.
+*/
+int report_page_placement(const char* name, float* arr, int height, int width, const int* node_ids, int nodes){
+
+    const long page_size = sysconf(_SC_PAGESIZE);
+    const size_t floats_per_page = page_size / sizeof(float);
+    const size_t total_pages = ((size_t)height * width + floats_per_page - 1) / floats_per_page;
+
+    void** pages = (void**)malloc(total_pages * sizeof(void*));
+    int* status = (int*)malloc(total_pages * sizeof(int));
+    int* counts = (int*)calloc((size_t)nodes * nodes, sizeof(int));
+    if (pages == NULL || status == NULL || counts == NULL){
+        free(pages); free(status); free(counts);
+        return 1;
+    }
+
+    for (size_t p = 0; p < total_pages; p++){
+        pages[p] = (void*)(arr + p * floats_per_page);
+    }
+
+    // With no target nodes, move_pages() only reports the node each page currently lives on
+    if (syscall(SYS_move_pages, 0, total_pages, pages, NULL, status, 0) != 0){
+        printf("%s: page placement unavailable.\n", name);
+        free(pages); free(status); free(counts);
+        return 1;
+    }
+
+    // Count pages per (expected band, actual node)
+    int misplaced = 0;
+    for (size_t p = 0; p < total_pages; p++){
+        const int row = (int)((p * floats_per_page) / width);
+        const int band = (int)(((long)row * nodes) / height);
+        int node = 0;
+        while (node < nodes && node_ids[node] != status[p]) { node++; }
+        if (status[p] >= 0 && node < nodes){
+            counts[IDX(band, node, nodes)]++;
+            misplaced += node != band;
+        }
+    }
+
+    printf("%s page placement (%zu pages, %d off-node):\n", name, total_pages, misplaced);
+    for (int band = 0; band < nodes; band++){
+        printf("    band %d:", band);
+        for (int node = 0; node < nodes; node++){
+            printf(" node%d=%d", node_ids[node], counts[IDX(band, node, nodes)]);
+        }
+        printf("\n");
+    }
+
+    free(pages); free(status); free(counts);
+    return 0;
+}
+
+
+/*
+Prepares a barrier that lives in memory shared between processes. Waiters spin on the generation counter,
+yielding the CPU between checks, so no kernel objects are needed.
+@param barrier      The barrier, in a MAP_SHARED mapping.
+@param parties      The number of processes that wait at each phase.
+*/
+void process_barrier_init(process_barrier* barrier, int parties){
+    atomic_init(&barrier->arrived, 0);
+    atomic_init(&barrier->generation, 0);
+    atomic_init(&barrier->failed, 0);
+    barrier->parties = parties;
+}
+
+
+/*
+Waits until every party has reached the barrier. The last to arrive resets the count and releases the rest.
+@param barrier      The barrier to wait at.
+*/
+void process_barrier_wait(process_barrier* barrier){
+
+    const int generation = atomic_load(&barrier->generation);
+    if (atomic_fetch_add(&barrier->arrived, 1) + 1 == barrier->parties){
+        atomic_store(&barrier->arrived, 0);
+        atomic_fetch_add(&barrier->generation, 1);
+        return;
+    }
+    while (atomic_load(&barrier->generation) == generation){
+        sched_yield();
+    }
+}
+
+
+/*
+The body of one fork_conv2d() worker process. It pins itself to its NUMA node, copies its band of the
+feature map into the shared segment so the pages are first touched there, and convolves the band with its
+own team of threads. A worker that fails still passes every barrier, so the others never wait on it.
+@param worker           This worker's index.
+@param workers          The number of workers.
+@param team_size        The number of threads for this worker.
+@param f                The caller's padded Feature Map, inherited copy-on-write.
+@param shared_f         The padded Feature Map in the shared segment.
+@param shared_output    The outputs in the shared segment.
+@param barrier          The barrier shared with the other workers and the parent.
+@param stats            Where this worker records its band and timing.
+*/
+int fork_worker(int worker, int workers, int team_size, float* f, float* shared_f, float* shared_output, int H, int W,
+    float* g, int kH, int kW, int w_padding, int h_padding, process_barrier* barrier, fork_worker_stats* stats){
+
+    const int total_width = W + w_padding*2;
+    int node_ids[MAX_NUMA_NODES];
+    const int nodes = read_numa_nodes(node_ids);
+    const int first_row = (int)(((long)H * worker) / workers);
+    const int rows = (int)(((long)H * (worker + 1)) / workers) - first_row;
+
+    stats->node = node_ids[worker % nodes];
+    stats->first_row = first_row;
+    stats->rows = rows;
+
+    // Pin the whole process to its node before anything is touched. Threads started afterwards inherit it.
+    cpu_set_t node_cpus;
+    int failed = read_node_cpus(stats->node, &node_cpus) == 0 || sched_setaffinity(0, sizeof(node_cpus), &node_cpus) != 0;
+    omp_set_num_threads(team_size);
+#ifndef _OPENMP
+    failed |= team_size > 1 && thread_pool_start(team_size) != 0;
+#endif
+
+    // Stage this band's rows, and the padding rows above the first band or below the last
+    const int first_copy = worker == 0 ? 0 : first_row + h_padding;
+    const int last_copy = worker == workers - 1 ? H + h_padding*2 : first_row + rows + h_padding;
+    #pragma omp parallel for schedule(static)
+    for (int i = first_copy; i < last_copy; i++){
+        memcpy(shared_f + IDX(i, 0, total_width), f + IDX(i, 0, total_width), total_width * sizeof(float));
+    }
+    if (failed) { atomic_store(&barrier->failed, 1); }
+
+    // Every band must be staged before the halos can be read from the neighbouring bands
+    process_barrier_wait(barrier);
+
+    const double start_time = omp_get_wtime();
+    if (!failed && rows > 0){
+        float* band = shared_f + IDX(first_row, 0, total_width);
+        float* band_output = shared_output + IDX(first_row, 0, W);
+#ifdef _OPENMP
+        failed = parallel_conv2d(band, rows, W, g, kH, kW, w_padding, h_padding, (float_array){ band_output, NULL }) != 0;
+#else
+        failed = (team_size > 1
+            ? pool_conv2d(band, rows, W, g, kH, kW, w_padding, h_padding, band_output)
+            : conv2d(band, rows, W, g, kH, kW, w_padding, h_padding, band_output)) != 0;
+#endif
+        if (failed) { atomic_store(&barrier->failed, 1); }
+    }
+    stats->seconds = omp_get_wtime() - start_time;
+
+    process_barrier_wait(barrier);
+#ifndef _OPENMP
+    thread_pool_stop();
+#endif
+    return failed;
+}
+
+
+/*
+Convolves with one forked worker process per NUMA node, instead of one team of threads. Each worker maps
+the same shared input and output segments, but first touches only its own row band, from its own node,
+and runs its own OpenMP team, so workers don't contend on one allocator or one set of page tables.
+The workers and the parent meet at a shared-memory barrier once the inputs are staged, and again when
+the outputs are ready.
+Forked children can't start OpenMP teams if the parent already has one, so the caller must only have run
+single-threaded parallel regions so far.
+@param f             Pointer to the Feature Map.
+@param H             Height of the Feature Map.
+@param W             Width of the Feature Map.
+@param g             Pointer to the Kernel.
+@param kH            Height of the Kernel.
+@param kW            Width of the Kernel.
+@param w_padding     Width of the padding in the Feature Map.
+@param h_padding     Height of the padding in the Feature Map.
+@param output        Pointer to the location where outputs are stored.
+@param workers       The number of worker processes.
+@param team_size     The number of threads in each worker.
+@param stats         An array of one fork_worker_stats per worker, filled with each worker's band and time.
+*/
+int fork_conv2d(float* f, int H, int W, float* g, int kH, int kW, int w_padding, int h_padding, float* output,
+    int workers, int team_size, fork_worker_stats* stats){
+
+    const int total_width = W + w_padding*2;
+    const int total_height = H + h_padding*2;
+
+    // One segment: the barrier, each worker's stats, then the feature map and outputs on their own pages
+    const size_t page_size = (size_t)sysconf(_SC_PAGESIZE);
+    const size_t header_bytes = (sizeof(process_barrier) + (size_t)workers * sizeof(fork_worker_stats) + page_size - 1) / page_size * page_size;
+    const size_t input_bytes = ((size_t)total_width * total_height * sizeof(float) + page_size - 1) / page_size * page_size;
+    const size_t segment_bytes = header_bytes + input_bytes + (size_t)W * H * sizeof(float);
+
+    char* segment = (char*)mmap(NULL, segment_bytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (segment == MAP_FAILED) { return 1; }
+
+    process_barrier* barrier = (process_barrier*)segment;
+    fork_worker_stats* shared_stats = (fork_worker_stats*)(segment + sizeof(process_barrier));
+    float* shared_f = (float*)(segment + header_bytes);
+    float* shared_output = (float*)(segment + header_bytes + input_bytes);
+    process_barrier_init(barrier, workers + 1);
+
+    // Anything still buffered would otherwise be printed again by every child
+    fflush(stdout);
+
+    pid_t* children = (pid_t*)malloc(workers * sizeof(pid_t));
+    if (children == NULL) { munmap(segment, segment_bytes); return 1; }
+
+    int started = 0;
+    for (; started < workers; started++){
+        children[started] = fork();
+        if (children[started] < 0) { break; }
+        if (children[started] == 0){
+            const int failed = fork_worker(started, workers, team_size, f, shared_f, shared_output, H, W, g, kH, kW,
+                w_padding, h_padding, barrier, &shared_stats[started]);
+            _exit(failed);
+        }
+    }
+
+    int failed = started < workers;
+    if (failed){
+        // The barrier can never fill, so stop the workers that did start
+        for (int i = 0; i < started; i++) { kill(children[i], SIGKILL); }
+    } else {
+        process_barrier_wait(barrier);
+        process_barrier_wait(barrier);
+        failed = atomic_load(&barrier->failed);
+    }
+
+    for (int i = 0; i < started; i++){
+        int status = 0;
+        failed |= waitpid(children[i], &status, 0) < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0;
+    }
+
+    if (!failed){
+        memcpy(output, shared_output, (size_t)W * H * sizeof(float));
+        memcpy(stats, shared_stats, workers * sizeof(fork_worker_stats));
+    }
+
+    free(children);
+    munmap(segment, segment_bytes);
+    return failed;
+}
+
+
+// Profiler state. Events are appended from any thread through an atomic counter.
+int profiling_enabled = 0;
+double profile_origin = 0.0;
+profile_event profile_events[MAX_PROFILE_EVENTS];
+int profile_event_count = 0;
+
+
+/*
+Turns on the profiler. Until this is called, profile_begin() and profile_end() do nothing.
+*/
+void enable_profiling(){
+    profile_origin = omp_get_wtime();
+    profiling_enabled = 1;
+}
+
+
+/*
+Starts timing a region. Pair with profile_end().
+@return     The start time, or 0 when profiling is disabled.
+*/
+double profile_begin(){
+    return profiling_enabled ? omp_get_wtime() - profile_origin : 0.0;
+}
+
+
+/*
+Records a timed region on the calling thread.
+@param name     The name of the region. Must outlive the profiler, e.g. a string literal.
+@param start    The time returned by profile_begin().
+*/
+void profile_end(const char* name, double start){
+
+    if (!profiling_enabled) { return; }
+
+    const double end = omp_get_wtime() - profile_origin;
+
+    int slot;
+    #pragma omp atomic capture
+    slot = profile_event_count++;
+
+    if (slot < MAX_PROFILE_EVENTS){
+        profile_events[slot] = (profile_event){ name, omp_get_thread_num(), start, end };
+    }
+}
+
+
+/*
+Prints a summary of every named region: how often it ran and how long it took. Regions recorded by
+more than one thread also get their per-thread totals and an imbalance ratio (slowest / mean).
+*/
+int print_profile_summary(){
+
+    const int count = min(profile_event_count, MAX_PROFILE_EVENTS);
+    const int max_threads = omp_get_max_threads();
+    double* thread_totals = (double*)malloc(max_threads * sizeof(double));
+    char* reported = (char*)calloc(count, 1);
+    if (thread_totals == NULL || reported == NULL){ free(thread_totals); free(reported); return 1; }
+
+    printf("%-36s %6s %12s %12s %12s\n", "phase", "calls", "total(ms)", "mean(ms)", "max(ms)");
+
+    for (int i = 0; i < count; i++){
+        if (reported[i]) { continue; }
+
+        const char* name = profile_events[i].name;
+        int calls = 0, threads_seen = 0;
+        double total = 0.0, longest = 0.0;
+        for (int t = 0; t < max_threads; t++) { thread_totals[t] = 0.0; }
+
+        // Gather every event with this name. Names are string literals, but compare contents to be safe.
+        for (int j = i; j < count; j++){
+            if (reported[j] || strcmp(profile_events[j].name, name) != 0) { continue; }
+            reported[j] = 1;
+
+            const double duration = profile_events[j].end - profile_events[j].start;
+            calls++;
+            total += duration;
+            longest = max(longest, duration);
+            if (profile_events[j].thread < max_threads) { thread_totals[profile_events[j].thread] += duration; }
+        }
+
+        printf("%-36s %6d %12.3f %12.3f %12.3f\n", name, calls, total * 1e3, total / calls * 1e3, longest * 1e3);
+
+        // Per-thread breakdown, for regions recorded inside parallel regions
+        double slowest = 0.0, thread_sum = 0.0;
+        for (int t = 0; t < max_threads; t++){
+            if (thread_totals[t] <= 0.0) { continue; }
+            threads_seen++;
+            thread_sum += thread_totals[t];
+            slowest = max(slowest, thread_totals[t]);
+        }
+        if (threads_seen > 1){
+            printf("    imbalance (slowest / mean thread): %.3f\n", slowest / (thread_sum / threads_seen));
+            for (int t = 0; t < max_threads; t++){
+                if (thread_totals[t] > 0.0) { printf("    thread %-3d %12.3f ms\n", t, thread_totals[t] * 1e3); }
+            }
+        }
+    }
+
+    if (profile_event_count > MAX_PROFILE_EVENTS){
+        printf("(%d events dropped, only the first %d were kept)\n", profile_event_count - MAX_PROFILE_EVENTS, MAX_PROFILE_EVENTS);
+    }
+
+    free(thread_totals);
+    free(reported);
+    return 0;
+}
+
+
+/*
+Writes every recorded region as a Chrome trace-event JSON file, which can be opened in chrome://tracing
+or Perfetto. Each OpenMP thread gets its own track.
+@param filepath     The filepath of the trace file.
+*/
+int write_profile_trace(char* filepath){
+    if (filepath == NULL){ return 1; }
+    FILE* file_ptr = fopen(filepath, "w");
+    if (file_ptr == NULL){ return 1; }
+
+    const int count = min(profile_event_count, MAX_PROFILE_EVENTS);
+
+    fprintf(file_ptr, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n");
+    for (int i = 0; i < count; i++){
+        // Complete ("X") events, with timestamps and durations in microseconds
+        fprintf(file_ptr, "  {\"name\": \"%s\", \"ph\": \"X\", \"pid\": 0, \"tid\": %d, \"ts\": %.3f, \"dur\": %.3f}%s\n",
+            profile_events[i].name, profile_events[i].thread, profile_events[i].start * 1e6,
+            (profile_events[i].end - profile_events[i].start) * 1e6, i + 1 < count ? "," : "");
+    }
+    fprintf(file_ptr, "]}\n");
+
+    fclose(file_ptr);
+    return 0;
+}
+
+
+// Per-thread counter file descriptors, opened by start_perf_counters(). -1 where a counter is unavailable.
+int perf_fds[MAX_PERF_THREADS][PERF_COUNTER_COUNT];
+int perf_thread_count = 0;
+
+// Names used when printing each counter
+const char* perf_counter_names[PERF_COUNTER_COUNT] = {
+    "cycles", "instructions", "L1D read misses", "LLC misses", "dTLB read misses",
+    "FP scalar single", "FP 128-bit packed single", "FP 256-bit packed single", "FP 512-bit packed single", "task clock (ns)"
+};
+
+
+/*
+Checks whether this is an Intel CPU, whose raw FP_ARITH_INST_RETIRED events we know how to count.
+*/
+int is_intel_cpu(){
+    FILE* file_ptr = fopen("/proc/cpuinfo", "r");
+    if (file_ptr == NULL){ return 0; }
+
+    char line[256];
+    int intel = 0;
+    while (fgets(line, sizeof(line), file_ptr) != NULL){
+        if (strncmp(line, "vendor_id", 9) == 0){
+            intel = strstr(line, "GenuineIntel") != NULL;
+            break;
+        }
+    }
+    fclose(file_ptr);
+    return intel;
+}
+
+
+/*
+Fills in the perf_event_open() type and config for one of the PERF_ counters.
+@return     0 on success, or 1 if the counter isn't supported on this CPU.
+*/
+int perf_counter_config(int counter, int intel, struct perf_event_attr* attr){
+
+    // Cache events are encoded as cache | (operation << 8) | (result << 16)
+    const unsigned long long read_miss = (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+
+    attr->type = PERF_TYPE_HARDWARE;
+    switch (counter){
+        case PERF_CYCLES:       attr->config = PERF_COUNT_HW_CPU_CYCLES; return 0;
+        case PERF_INSTRUCTIONS: attr->config = PERF_COUNT_HW_INSTRUCTIONS; return 0;
+        case PERF_LLC_MISSES:   attr->config = PERF_COUNT_HW_CACHE_MISSES; return 0;
+        case PERF_L1D_MISSES:   attr->type = PERF_TYPE_HW_CACHE; attr->config = PERF_COUNT_HW_CACHE_L1D | read_miss; return 0;
+        case PERF_DTLB_MISSES:  attr->type = PERF_TYPE_HW_CACHE; attr->config = PERF_COUNT_HW_CACHE_DTLB | read_miss; return 0;
+        case PERF_TASK_CLOCK:   attr->type = PERF_TYPE_SOFTWARE; attr->config = PERF_COUNT_SW_TASK_CLOCK; return 0;
+    }
+
+    // FP_ARITH_INST_RETIRED is event 0xC7, with one umask per vector width
+    if (!intel) { return 1; }
+    const unsigned long long umasks[] = { 0x02, 0x08, 0x20, 0x80 };
+    attr->type = PERF_TYPE_RAW;
+    attr->config = 0xC7 | (umasks[counter - PERF_FP_SCALAR] << 8);
+    return 0;
+}
+
+
+/*
+Opens, resets and enables every counter on every thread of the next parallel region. The team size must
+match the one used by the code being measured, so the same OpenMP threads are counted.
+@return     The number of counters that could be opened on the master thread.
+*/
+int start_perf_counters(){
+
+    const int intel = is_intel_cpu();
+    int opened = 0;
+
+    #pragma omp parallel reduction(+:opened)
+    {
+        const int thread = omp_get_thread_num();
+
+        #pragma omp single
+        perf_thread_count = min(omp_get_num_threads(), MAX_PERF_THREADS);
+
+        for (int counter = 0; thread < MAX_PERF_THREADS && counter < PERF_COUNTER_COUNT; counter++){
+
+            struct perf_event_attr attr;
+            memset(&attr, 0, sizeof(attr));
+            attr.size = sizeof(attr);
+            attr.disabled = 1;
+            attr.exclude_kernel = 1;
+            attr.exclude_hv = 1;
+            attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+            // pid 0 and cpu -1 count the calling thread, wherever it runs
+            int fd = -1;
+            if (perf_counter_config(counter, intel, &attr) == 0){
+                fd = (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+            }
+            perf_fds[thread][counter] = fd;
+
+            if (fd >= 0){
+                ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+                ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+                if (thread == 0) { opened++; }
+            }
+        }
+    }
+    return opened;
+}
+
+
+/*
+Stops and closes the counters opened by start_perf_counters(), adding their values into the totals, so
+repeated runs accumulate. Counters are scaled up when the kernel had to multiplex them.
+@param totals       Summed over every thread. Start from zero. Unavailable counters are set to -1.
+@param per_thread   Optional, MAX_PERF_THREADS entries, also starting from zero. Each thread adds to its own.
+@return             The number of threads that were counted.
+*/
+int stop_perf_counters(perf_counts* totals, perf_counts* per_thread){
+
+    // Availability is judged by the master thread, which every measured region runs on
+    int available[PERF_COUNTER_COUNT];
+    for (int counter = 0; counter < PERF_COUNTER_COUNT; counter++){
+        available[counter] = perf_fds[0][counter] >= 0;
+    }
+
+    #pragma omp parallel
+    {
+        const int thread = omp_get_thread_num();
+
+        for (int counter = 0; thread < perf_thread_count && counter < PERF_COUNTER_COUNT; counter++){
+
+            const int fd = perf_fds[thread][counter];
+            if (fd < 0) { continue; }
+            ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+
+            // value, time enabled, time running
+            unsigned long long data[3] = { 0, 0, 0 };
+            long long value = -1;
+            if (read(fd, data, sizeof(data)) == sizeof(data) && data[2] > 0){
+                value = (long long)((double)data[0] * data[1] / data[2]);
+            }
+            close(fd);
+            perf_fds[thread][counter] = -1;
+            if (value < 0) { continue; }
+
+            #pragma omp atomic
+            totals->values[counter] += value;
+
+            if (per_thread != NULL) { per_thread[thread].values[counter] += value; }
+        }
+    }
+
+    for (int counter = 0; counter < PERF_COUNTER_COUNT; counter++){
+        if (available[counter]) { continue; }
+        totals->values[counter] = -1;
+        for (int thread = 0; per_thread != NULL && thread < perf_thread_count; thread++){
+            per_thread[thread].values[counter] = -1;
+        }
+    }
+    return perf_thread_count;
+}
+
+
+/*
+Counts the single precision floating point operations from the FP_ counters, weighting each instruction
+by its vector width. Fused multiply-adds already count twice in these events.
+@return     The operation count, or -1 if the FP counters were unavailable.
+*/
+long long perf_fp_ops(perf_counts* counts){
+    const long long* v = counts->values;
+    if (v[PERF_FP_SCALAR] < 0 || v[PERF_FP_128] < 0 || v[PERF_FP_256] < 0 || v[PERF_FP_512] < 0) { return -1; }
+    return v[PERF_FP_SCALAR] + 4 * v[PERF_FP_128] + 8 * v[PERF_FP_256] + 16 * v[PERF_FP_512];
+}
+
+
+/*
+Prints the counter totals, per-thread IPC, and metrics derived from them.
+@param totals       Counters summed over all threads.
+@param per_thread   Per-thread counters, or NULL to skip the per-thread table.
+@param threads      The number of threads in per_thread.
+@param seconds      The wall-clock time that was counted.
+@param flops        The floating point operations the convolution needs, for the achieved FLOP/s.
+@param bytes        The compulsory memory traffic of the convolution, for the arithmetic intensity.
+*/
+int print_perf_report(perf_counts* totals, perf_counts* per_thread, int threads, double seconds, double flops, double bytes){
+
+    const long long* v = totals->values;
+
+    printf("Hardware counters (%d threads, %.6f s):\n", threads, seconds);
+    for (int counter = 0; counter < PERF_COUNTER_COUNT; counter++){
+        if (v[counter] < 0){
+            printf("    %-26s %18s\n", perf_counter_names[counter], "unavailable");
+        } else {
+            printf("    %-26s %18lld\n", perf_counter_names[counter], v[counter]);
+        }
+    }
+
+    if (per_thread != NULL && v[PERF_CYCLES] > 0 && v[PERF_INSTRUCTIONS] >= 0){
+        for (int thread = 0; thread < threads; thread++){
+            const long long* t = per_thread[thread].values;
+            printf("    thread %-3d cycles %14lld  instructions %14lld  IPC %.3f\n",
+                thread, t[PERF_CYCLES], t[PERF_INSTRUCTIONS], t[PERF_CYCLES] > 0 ? (double)t[PERF_INSTRUCTIONS] / t[PERF_CYCLES] : 0.0);
+        }
+    }
+
+    // Derived metrics. The achieved FLOP/s uses the measured FP operations when available.
+    const long long fp_ops = perf_fp_ops(totals);
+    printf("Derived metrics:\n");
+    if (v[PERF_CYCLES] > 0 && v[PERF_INSTRUCTIONS] >= 0){
+        printf("    %-44s %.3f\n", "IPC", (double)v[PERF_INSTRUCTIONS] / v[PERF_CYCLES]);
+    }
+    printf("    %-44s %.3f\n", "achieved GFLOP/s (analytic)", flops / seconds * 1e-9);
+    if (fp_ops >= 0){
+        printf("    %-44s %.3f\n", "achieved GFLOP/s (measured)", fp_ops / seconds * 1e-9);
+    }
+    printf("    %-44s %.3f FLOP/byte\n", "arithmetic intensity (compulsory traffic)", flops / bytes);
+    if (v[PERF_LLC_MISSES] > 0){
+        // Every LLC miss brings in one 64-byte line from memory
+        printf("    %-44s %.3f FLOP/byte\n", "arithmetic intensity (LLC miss traffic)", flops / (64.0 * v[PERF_LLC_MISSES]));
+    }
+    if (v[PERF_TASK_CLOCK] > 0){
+        printf("    %-44s %.2f threads busy\n", "CPU utilisation", v[PERF_TASK_CLOCK] * 1e-9 / seconds);
+    }
+    return 0;
+}
+
+
+/*
+Computes the convolution in double precision with Kahan (compensated) summation, as a reference for the
+float engines. Uses the same tap order as conv2d(), and is parallel over rows.
+@param f            Pointer to the Feature Map.
+@param H            Height of the Feature Map.
+@param W            Width of the Feature Map.
+@param g            Pointer to the Kernel.
+@param kH           Height of the Kernel.
+@param kW           Width of the Kernel.
+@param w_padding    Width of the padding in the Feature Map.
+@param h_padding    Height of the padding in the Feature Map.
+@param output       H x W reference outputs.
+@param magnitude    H x W sums of |f * g| over each window, which bound how much rounding error is reasonable.
+*/
+int reference_conv2d(float* f, int H, int W, float* g, int kH, int kW, int w_padding, int h_padding, double* output, double* magnitude){
+
+    const int total_width = W + w_padding*2;
+    const int M = (kH - 1) / 2;
+    const int N = (kW - 1) / 2;
+
+    #pragma omp parallel for schedule(static)
+    for (int n = h_padding; n < H + h_padding; n++){
+        for (int k = w_padding; k < W + w_padding; k++){
+
+            double sum = 0.0, compensation = 0.0, absolute = 0.0;
+
+            for (int j = 0; j < kW; j++){
+                for (int i = 0; i < kH; i++){
+                    const double product = (double)f[IDX(n + i - M, k + j - N, total_width)] * (double)g[IDX(i, j, kW)];
+
+                    // Kahan summation: carry the low-order bits lost by each addition into the next one
+                    const double corrected = product - compensation;
+                    const double total = sum + corrected;
+                    compensation = (total - sum) - corrected;
+                    sum = total;
+
+                    absolute += fabs(product);
+                }
+            }
+            output[IDX(n - h_padding, k - w_padding, W)] = sum;
+            magnitude[IDX(n - h_padding, k - w_padding, W)] = absolute;
+        }
+    }
+    return 0;
+}
+
+
+/*
+Maps a float's bits onto a monotonic integer line, so the difference of two mapped values is their
+distance in units in the last place (ULPs).
+*/
+long long float_to_ordered(float value){
+    int bits;
+    memcpy(&bits, &value, sizeof(bits));
+    return bits < 0 ? -(long long)(bits & 0x7fffffff) : (long long)bits;
+}
+
+
+/*
+The -verify tolerance used when none is given. fp32 outputs get DEFAULT_VERIFY_TOLERANCE. fp16 and bf16
+outputs are rounded once more when they're stored, by up to the storage type's unit roundoff relative to
+the sum of |f * g|, on top of the fp32 accumulation error of the kH * kW terms in each window. The feature
+map is rounded before the reference reads it, so input rounding adds nothing.
+@param dtype    The DTYPE_ the outputs were stored in.
+@param kH       Height of the Kernel.
+@param kW       Width of the Kernel.
+*/
+double default_verify_tolerance(int dtype, int kH, int kW){
+
+    if (dtype == DTYPE_FP32) { return DEFAULT_VERIFY_TOLERANCE; }
+
+    // Unit roundoff: half a unit in the last place of 1, with 11 significant bits for fp16 and 8 for bf16
+    const double storage_roundoff = dtype == DTYPE_FP16 ? ldexp(1.0, -11) : ldexp(1.0, -8);
+    const double fp32_roundoff = ldexp(1.0, -24);
+    return 2.0 * storage_roundoff + 2.0 * kH * kW * fp32_roundoff;
+}
+
+
+/*
+Compares float outputs with a double precision reference, printing the error statistics.
+@param title        What the outputs are being compared with, for the heading.
+@param reference    The H x W reference outputs.
+@param magnitude    The sum of |terms| behind each reference output, which normalises its error.
+@param output       The H x W outputs to check.
+@param H            Height of the outputs.
+@param W            Width of the outputs.
+@param tolerance    The largest error allowed for any output, relative to its magnitude.
+@param absolute     An absolute error every output is allowed regardless: one output step for quantized
+                    outputs, and 0 otherwise.
+@return             0 if every output is within the tolerance, or 1 if not.
+*/
+int report_verification(const char* title, double* reference, double* magnitude, float* output, int H, int W, double tolerance, double absolute){
+
+    const size_t count = (size_t)H * W;
+    double max_absolute = 0.0, max_relative = 0.0, max_normalised = 0.0, total_ulps = 0.0;
+    long long max_ulps = 0;
+    size_t failures = 0, worst = 0;
+
+    for (size_t i = 0; i < count; i++){
+        const double error = fabs((double)output[i] - reference[i]);
+        const long long ulps = llabs(float_to_ordered(output[i]) - float_to_ordered((float)reference[i]));
+
+        // Normalising by the sum of |terms| keeps cancelling sums from looking worse than they are
+        const double normalised = magnitude[i] > 0.0 ? error / magnitude[i] : error;
+
+        max_absolute = max(max_absolute, error);
+        if (reference[i] != 0.0) { max_relative = max(max_relative, error / fabs(reference[i])); }
+        if (ulps > max_ulps) { max_ulps = ulps; }
+        total_ulps += (double)ulps;
+        if (normalised > max_normalised) { max_normalised = normalised; worst = i; }
+        failures += (normalised > tolerance && error > absolute) || isnan(output[i]);
+    }
+
+    printf("Verification against %s (%zu outputs):\n", title, count);
+    if (absolute > 0.0) { printf("    absolute tolerance      %.3e\n", absolute); }
+    printf("    max absolute error      %.3e\n", max_absolute);
+    printf("    max relative error      %.3e\n", max_relative);
+    printf("    max normalised error    %.3e (at row %zu, column %zu; tolerance %.1e)\n", max_normalised, worst / W, worst % W, tolerance);
+    printf("    ULP error               max %lld, mean %.3f\n", max_ulps, total_ulps / count);
+    printf("    %s: %zu outputs out of tolerance\n", failures == 0 ? "PASSED" : "FAILED", failures);
+
+    return failures != 0;
+}
+
+
+/*
+Compares float outputs with the double precision reference, printing the error statistics.
+@param f            Pointer to the Feature Map.
+@param H            Height of the Feature Map.
+@param W            Width of the Feature Map.
+@param g            Pointer to the Kernel.
+@param kH           Height of the Kernel.
+@param kW           Width of the Kernel.
+@param w_padding    Width of the padding in the Feature Map.
+@param h_padding    Height of the padding in the Feature Map.
+@param output       The H x W outputs to check.
+@param tolerance    The largest error allowed for any output, relative to the sum of |f * g| over its window.
+@param absolute     An absolute error every output is allowed regardless: one output step for quantized
+                    outputs, and 0 otherwise.
+@return             0 if every output is within the tolerance, 1 if not, or 2 if the reference couldn't be computed.
+*/
+int verify_outputs(float* f, int H, int W, float* g, int kH, int kW, int w_padding, int h_padding, float* output, double tolerance, double absolute){
+
+    const size_t count = (size_t)H * W;
+    double* reference = (double*)malloc(count * sizeof(double));
+    double* magnitude = (double*)malloc(count * sizeof(double));
+    if (reference == NULL || magnitude == NULL){
+        free(reference); free(magnitude);
+        return 2;
+    }
+
+    reference_conv2d(f, H, W, g, kH, kW, w_padding, h_padding, reference, magnitude);
+
+    // The engines apply the epilogue, so the reference does too
+    if (conv2d_epilogue.enabled){
+        const double step = apply_epilogue_reference(reference, magnitude, count, &conv2d_epilogue);
+        absolute = max(absolute, step);
+    }
+    const int failed = report_verification("a double precision, Kahan-summed reference", reference, magnitude, output, H, W, tolerance, absolute);
+
+    free(reference);
+    free(magnitude);
+    return failed;
+}
+
+
+/*
+Checks stencil_conv2d() against the reduction of each kernel's double precision reference. Each output's sum
+of |terms| is carried through the reduction by how far the kernels' errors can move it: the root of the sum
+of their squares for STENCIL_MAGNITUDE, the largest for STENCIL_MAX, and the sum of 2 |response| * magnitude
+for STENCIL_SUM_SQUARES. An STENCIL_ARGMAX index passes if its kernel's response is within the tolerance of
+the largest, since a near tie may go either way; the reference is the true argmax otherwise. Indices are
+compared after any epilogue, and where it maps several to the same output, the largest response counts.
+@param f            Pointer to the Feature Map.
+@param H            Height of the Feature Map.
+@param W            Width of the Feature Map.
+@param kernels      The kernels, all of the same size.
+@param kernel_count The number of kernels.
+@param w_padding    Width of the padding in the Feature Map.
+@param h_padding    Height of the padding in the Feature Map.
+@param output       The H x W outputs to check.
+@param reduction    The STENCIL_ reduction that stencil_conv2d() applied.
+@param tolerance    The largest error allowed for any output, relative to its combined sum of |terms|.
+@return             0 if every output is within the tolerance, 1 if not, or 2 if the reference couldn't be computed.
+*/
+int verify_stencil(float* f, int H, int W, const pipeline_stage* kernels, int kernel_count, int w_padding, int h_padding, float* output, int reduction, double tolerance){
+
+    const size_t count = (size_t)H * W;
+    const int argmax = reduction == STENCIL_ARGMAX;
+    double* response = (double*)malloc(count * sizeof(double));
+    double* response_magnitude = (double*)malloc(count * sizeof(double));
+    double* reference = (double*)calloc(count, sizeof(double));
+    double* magnitude = (double*)calloc(count, sizeof(double));
+
+    // For argmax: each index after the epilogue, the index of the largest response, and the response and
+    // magnitude of the kernel each output chose
+    float codes[MAX_PIPELINE_STAGES];
+    for (int c = 0; c < kernel_count; c++) { codes[c] = conv2d_epilogue.enabled ? apply_epilogue((float)c, &conv2d_epilogue) : (float)c; }
+    double* best = argmax ? (double*)malloc(count * sizeof(double)) : NULL;
+    double* chosen = argmax ? (double*)malloc(count * sizeof(double)) : NULL;
+    double* chosen_magnitude = argmax ? (double*)malloc(count * sizeof(double)) : NULL;
+    if (response == NULL || response_magnitude == NULL || reference == NULL || magnitude == NULL || (argmax && (best == NULL || chosen == NULL || chosen_magnitude == NULL))){
+        free(response); free(response_magnitude); free(reference); free(magnitude); free(best); free(chosen); free(chosen_magnitude);
+        return 2;
+    }
+
+    for (size_t i = 0; argmax && i < count; i++) { chosen[i] = -INFINITY; }
+
+    for (int c = 0; c < kernel_count; c++){
+        reference_conv2d(f, H, W, kernels[c].g, kernels[c].kH, kernels[c].kW, w_padding, h_padding, response, response_magnitude);
+
+        #pragma omp parallel for schedule(static)
+        for (size_t i = 0; i < count; i++){
+            const double r = response[i], m = response_magnitude[i];
+            if (reduction == STENCIL_MAGNITUDE || reduction == STENCIL_SUM_SQUARES){
+                reference[i] += r * r;
+                magnitude[i] += reduction == STENCIL_MAGNITUDE ? m * m : 2.0 * fabs(r) * m;
+            } else {
+                // Ties go to the first kernel, as in stencil_conv2d()
+                const int larger = c == 0 || r > reference[i];
+                reference[i] = larger ? r : reference[i];
+                magnitude[i] = argmax ? (larger ? m : magnitude[i]) : max(magnitude[i], m);
+                if (argmax && larger) { best[i] = c; }
+                if (argmax && output[i] == codes[c] && r > chosen[i]) { chosen[i] = r; chosen_magnitude[i] = m; }
+            }
+        }
+    }
+
+    for (size_t i = 0; i < count; i++){
+        if (reduction == STENCIL_MAGNITUDE){
+            reference[i] = sqrt(reference[i]);
+            magnitude[i] = sqrt(magnitude[i]);
+        } else if (argmax){
+            const int near_tie = chosen[i] >= reference[i] - tolerance * (chosen_magnitude[i] + magnitude[i]);
+            reference[i] = near_tie ? output[i] : codes[(int)best[i]];
+            magnitude[i] = 0.0;
+        }
+    }
+
+    // stencil_conv2d() applies the epilogue to the combined outputs. Argmax's codes already include it.
+    double absolute = 0.0;
+    if (conv2d_epilogue.enabled && !argmax) { absolute = apply_epilogue_reference(reference, magnitude, count, &conv2d_epilogue); }
+    const int failed = report_verification("the reduction of double precision, Kahan-summed references", reference, magnitude, output, H, W, tolerance, absolute);
+
+    free(response); free(response_magnitude); free(reference); free(magnitude); free(best); free(chosen); free(chosen_magnitude);
+    return failed;
+}
+
+
+/*
+Checks gaussian_filter() against a sampled Gaussian kernel, truncated at GAUSSIAN_VERIFY_RADIUS sigmas and
+normalised to sum to 1, applied in double precision with the same zero borders. Both the reference and
+the sum of |f * g| that normalises each error are separable, so they're computed a row pass then a column
+pass at a time.
+@param f            Pointer to the Feature Map.
+@param H            Height of the Feature Map.
+@param W            Width of the Feature Map.
+@param sigma        Standard deviation of the Gaussian.
+@param w_padding    Width of the padding in the Feature Map.
+@param h_padding    Height of the padding in the Feature Map.
+@param output       The H x W outputs to check.
+@param tolerance    The largest error allowed for any output, relative to the sum of |f * g| over its window.
+@return             0 if every output is within the tolerance, 1 if not, or 2 if the reference couldn't be computed.
+*/
+int verify_gaussian(float* f, int H, int W, double sigma, int w_padding, int h_padding, float* output, double tolerance){
+
+    const int total_width = W + w_padding*2;
+    const int radius = (int)ceil(GAUSSIAN_VERIFY_RADIUS * sigma);
+    const size_t count = (size_t)H * W;
+
+    double* taps = (double*)malloc((radius*2 + 1) * sizeof(double));
+    double* rows = (double*)malloc(count * sizeof(double));
+    double* row_magnitude = (double*)malloc(count * sizeof(double));
+    double* reference = (double*)malloc(count * sizeof(double));
+    double* magnitude = (double*)malloc(count * sizeof(double));
+    if (taps == NULL || rows == NULL || row_magnitude == NULL || reference == NULL || magnitude == NULL){
+        free(taps); free(rows); free(row_magnitude); free(reference); free(magnitude);
+        return 2;
+    }
 
-            // Depending if paralleism is enabled or not, print the outputs
-            if (outputs != NULL){
-                fprintf(file_ptr, "%.3f ", outputs[IDX(i-h_padding, j-w_padding, w_dimension)]);
-            } else if (padded_outputs.arr != NULL){
-                fprintf(file_ptr, "%.3f ", padded_outputs.arr[IDX(i-h_padding, j-w_padding, w_dimension)]);
-            } else { return 1; }
-            
+    double total = 0.0;
+    for (int i = -radius; i <= radius; i++){
+        taps[i + radius] = exp(-0.5 * i * i / (sigma * sigma));
+        total += taps[i + radius];
+    }
+    for (int i = 0; i <= radius*2; i++) { taps[i] /= total; }
+
+    // Along the rows. Columns outside the map are zero.
+    #pragma omp parallel for schedule(static)
+    for (int n = 0; n < H; n++){
+        const float* row = f + IDX(n + h_padding, w_padding, total_width);
+        for (int k = 0; k < W; k++){
+            double sum = 0.0, absolute = 0.0;
+            for (int i = max(-radius, -k); i <= min(radius, W - 1 - k); i++){
+                sum += taps[i + radius] * row[k + i];
+                absolute += taps[i + radius] * fabs(row[k + i]);
+            }
+            rows[IDX(n, k, W)] = sum;
+            row_magnitude[IDX(n, k, W)] = absolute;
         }
-        fprintf(file_ptr, "\n");
     }
 
-    fclose(file_ptr);
+    // Down the columns
+    #pragma omp parallel for schedule(static)
+    for (int n = 0; n < H; n++){
+        for (int k = 0; k < W; k++){
+            double sum = 0.0, absolute = 0.0;
+            for (int i = max(-radius, -n); i <= min(radius, H - 1 - n); i++){
+                sum += taps[i + radius] * rows[IDX(n + i, k, W)];
+                absolute += taps[i + radius] * row_magnitude[IDX(n + i, k, W)];
+            }
+            reference[IDX(n, k, W)] = sum;
+            magnitude[IDX(n, k, W)] = absolute;
+        }
+    }
 
-    return 0;
+    char title[96];
+    snprintf(title, sizeof(title), "a sampled Gaussian kernel of radius %d, in double precision", radius);
+    const int failed = report_verification(title, reference, magnitude, output, H, W, tolerance, 0.0);
 
+    free(taps); free(rows); free(row_magnitude); free(reference); free(magnitude);
+    return failed;
 }
 
 
 /*
-Generates a 2d array of random floats.
-@param height   The height of the array.
-@param width    The width of the array.
-@param output   The location where the generated data will be stored.
+Builds the kernel whose forward convolution equals conv2d_transpose() with g, so the transposed engine can
+be checked by verify_outputs(): g flipped in both directions. An even dimension gains a trailing zero tap,
+since the flipped window is centred one place later than the forward one.
+@param g        The kernel.
+@param kH       Height of the kernel.
+@param kW       Width of the kernel.
+@param fH       The location where the flipped kernel's height will be stored.
+@param fW       The location where the flipped kernel's width will be stored.
+@return         The flipped kernel, to be freed by the caller, or NULL if it couldn't be allocated.
 */
-int generate_data(int height, int width, float* *output){
+float* flip_kernel(float* g, int kH, int kW, int* fH, int* fW){
 
-    // Make a new random seed. This stops f from being the same as g when the code runs too fast.
-    srand(rand());
-    
-    for (int i=0; i<height; i++){
-        for (int j=0; j<width; j++){
-            (*output)[IDX(i,j,width)] = (float)rand() / (float)RAND_MAX;
+    *fH = kH | 1;
+    *fW = kW | 1;
+    float* flipped = (float*)calloc((size_t)*fH * *fW, sizeof(float));
+    if (flipped == NULL) { return NULL; }
+
+    for (int i = 0; i < kH; i++){
+        for (int j = 0; j < kW; j++){
+            flipped[IDX(kH - 1 - i, kW - 1 - j, *fW)] = g[IDX(i, j, kW)];
         }
     }
-    return 0;
+    return flipped;
+}
+
+
+/*
+Checks a kernel gradient from conv2d_weight_grad() against a double precision, Kahan-summed reference,
+printing a summary like verify_outputs(). Each tap's error is normalised by the sum of |terms| it adds.
+@param f            Pointer to the Feature Map of the forward pass.
+@param H            Height of the Feature Map.
+@param W            Width of the Feature Map.
+@param grad_output  Pointer to the H x W gradient of the outputs.
+@param kH           Height of the Kernel.
+@param kW           Width of the Kernel.
+@param w_padding    Width of the padding in the Feature Map.
+@param h_padding    Height of the padding in the Feature Map.
+@param grad_kernel  The kH x kW gradient to check.
+@param tolerance    The largest normalised error that passes.
+@return             0 if every tap is within tolerance, or 1 if not.
+*/
+int verify_weight_grad(float* f, int H, int W, float* grad_output, int kH, int kW, int w_padding, int h_padding, float* grad_kernel, double tolerance){
+
+    const int total_width = W + w_padding*2;
+    const int M = (kH - 1) / 2;
+    const int N = (kW - 1) / 2;
+
+    double max_absolute = 0.0, max_normalised = 0.0;
+    int failures = 0, worst = 0;
+
+    #pragma omp parallel for schedule(dynamic) reduction(max:max_absolute) reduction(+:failures)
+    for (int t = 0; t < kH * kW; t++){
+        const int i = t / kW;
+        const int j = t % kW;
+
+        double sum = 0.0, compensation = 0.0, absolute = 0.0;
+        for (int n = 0; n < H; n++){
+            for (int k = 0; k < W; k++){
+                const double product = (double)f[IDX(n + h_padding + i - M, k + w_padding + j - N, total_width)] * (double)grad_output[IDX(n, k, W)];
+                const double corrected = product - compensation;
+                const double total = sum + corrected;
+                compensation = (total - sum) - corrected;
+                sum = total;
+                absolute += fabs(product);
+            }
+        }
+
+        const double error = fabs((double)grad_kernel[t] - sum);
+        const double normalised = absolute > 0.0 ? error / absolute : error;
+        max_absolute = max(max_absolute, error);
+        failures += normalised > tolerance || isnan(grad_kernel[t]);
+
+        #pragma omp critical
+        if (normalised > max_normalised) { max_normalised = normalised; worst = t; }
+    }
+
+    printf("Verification against a double precision, Kahan-summed reference (%d kernel taps):\n", kH * kW);
+    printf("    max absolute error      %.3e\n", max_absolute);
+    printf("    max normalised error    %.3e (at row %d, column %d; tolerance %.1e)\n", max_normalised, worst / kW, worst % kW, tolerance);
+    printf("    %s: %d taps out of tolerance\n", failures == 0 ? "PASSED" : "FAILED", failures);
+    return failures != 0;
 }
 
 
+// Built without main() when linked into other programs, such as the benchmark harness
+#ifndef CONV2D_NO_MAIN
+
 int main(int argc, char** argv) {
     
     // ~~~~~~~~~~~~~~~ MAIN CONTENTS ~~~~~~~~~~~~~~ //
@@ -285,8 +4355,6 @@ int main(int argc, char** argv) {
     // ~~~~~~~~~~~~~~~ 1. Argument Extraction ~~~~~~~~~~~~~~ //
 
 
-    omp_set_nested(1); // Allow nested parallelism for SIMD
-
     // Seed for random generation later
     srand(time(0));
 
@@ -304,6 +4372,32 @@ int main(int argc, char** argv) {
     int multi_benchmark_mode = 0;   // -mb <max_iterations>
     int max_iterations = 1;             // Used by multi_benchmark_mode to run the code multiple times, getting an average.
     int threads = 1;                // -t <threads>
+    int numa_mode = 0;              // -numa
+    int page_mode = PAGES_DEFAULT;  // -hp [thp|hugetlb]
+    int profile_mode = 0;           // -p
+    char* trace_file = NULL;        // -trace <path>
+    int perf_mode = 0;              // -perf
+    int verify_mode = 0;            // -verify [tolerance]
+    int deterministic_mode = 0;     // -deterministic
+    int sliding_mode = 0;           // -sliding
+    int tiled_mode = 0;             // -tiled
+    int fork_mode = 0;              // -fork [workers]
+    int fork_workers = 0;           // Defaults to one worker per NUMA node
+    int dtype = DTYPE_FP32;         // -dtype <fp32|fp16|bf16>
+    int quant = 0;                  // -quant <int8|int16>
+    int accumulator = ACCUMULATE_FP32;  // -accumulate <fp32|fp64|pairwise|kahan>
+    double sparse_threshold = SPARSE_DENSITY_THRESHOLD;  // -sparse <density>
+    int box_mode = 0;               // -box
+    double gaussian_sigma = 0.0;    // -gaussian <sigma>
+    char* pipeline_spec = NULL;     // -pipeline <stage,stage,...>
+    int stencil = -1;               // -stencil <magnitude|max|sumsq|argmax> <kernel,kernel,...>
+    char* stencil_spec = NULL;
+    int transpose_mode = 0;         // -transpose
+    int wgrad_mode = 0;             // -wgrad [path]
+    char* grad_file = NULL;
+    conv_epilogue epilogue = {0};   // -epilogue <op,op,...>
+    double verify_tolerance = DEFAULT_VERIFY_TOLERANCE;
+    int verify_tolerance_given = 0; // Otherwise default_verify_tolerance() picks one for the output type
     
 
     // Extract arguments into their variables
@@ -311,6 +4405,9 @@ int main(int argc, char** argv) {
 
         if (i + 1 > argc) { break; }
 
+        // Long options may also be given GNU-style, e.g. --verify
+        if (strncmp(argv[i], "--", 2) == 0) { argv[i]++; }
+
         // Check all flags
         if (strcmp(argv[i], "-H") == 0) {
             if (i + 1 >= argc) { printf("Incorrect usage of -H flag. Please provide an input height.\n"); return 1; }
@@ -357,10 +4454,116 @@ int main(int argc, char** argv) {
             max_iterations = atoi(argv[++i]) > 0 ? atoi(argv[i]) : 15;
             continue;
         }
+        if (strcmp(argv[i], "-p") == 0) {
+            profile_mode = 1;
+            continue;
+        }
+        if (strcmp(argv[i], "-trace") == 0) {
+            if (i + 1 >= argc) { printf("Incorrect usage of -trace flag. Please provide a filepath.\n"); return 1; }
+            trace_file = argv[++i];
+            continue;
+        }
+        if (strcmp(argv[i], "-dtype") == 0) {
+            if (i + 1 >= argc) { printf("Incorrect usage of -dtype flag. Please provide fp32, fp16 or bf16.\n"); return 1; }
+            dtype = parse_dtype(argv[++i]);
+            if (dtype < 0) { printf("Unknown -dtype %s. Please provide fp32, fp16 or bf16.\n", argv[i]); return 1; }
+            continue;
+        }
+        if (strcmp(argv[i], "-quant") == 0) {
+            if (i + 1 >= argc) { printf("Incorrect usage of -quant flag. Please provide int8 or int16.\n"); return 1; }
+            quant = parse_quant(argv[++i]);
+            if (quant < 0) { printf("Unknown -quant %s. Please provide int8 or int16.\n", argv[i]); return 1; }
+            continue;
+        }
+        if (strcmp(argv[i], "-accumulate") == 0) {
+            if (i + 1 >= argc) { printf("Incorrect usage of -accumulate flag. Please provide fp32, fp64, pairwise or kahan.\n"); return 1; }
+            accumulator = parse_accumulator(argv[++i]);
+            if (accumulator < 0) { printf("Unknown -accumulate %s. Please provide fp32, fp64, pairwise or kahan.\n", argv[i]); return 1; }
+            continue;
+        }
+        if (strcmp(argv[i], "-sparse") == 0) {
+            if (i + 1 >= argc) { printf("Incorrect usage of -sparse flag. Please provide a density threshold.\n"); return 1; }
+            sparse_threshold = atof(argv[++i]);
+            continue;
+        }
+        if (strcmp(argv[i], "-gaussian") == 0) {
+            if (i + 1 >= argc) { printf("Incorrect usage of -gaussian flag. Please provide a sigma.\n"); return 1; }
+            gaussian_sigma = atof(argv[++i]);
+            if (gaussian_sigma < GAUSSIAN_MIN_SIGMA) { printf("Please provide a sigma of at least %g for -gaussian.\n", GAUSSIAN_MIN_SIGMA); return 1; }
+            continue;
+        }
+        if (strcmp(argv[i], "-epilogue") == 0) {
+            if (i + 1 >= argc) { printf("Incorrect usage of -epilogue flag. Please provide a list of operations.\n"); return 1; }
+            if (parse_epilogue(argv[++i], &epilogue) != 0) { return 1; }
+            continue;
+        }
+        if (strcmp(argv[i], "-transpose") == 0) {
+            transpose_mode = 1;
+            continue;
+        }
+        if (strcmp(argv[i], "-wgrad") == 0) {
+            wgrad_mode = 1;
+            if (i + 1 < argc && argv[i + 1][0] != '-') { grad_file = argv[++i]; }
+            continue;
+        }
+        if (strcmp(argv[i], "-stencil") == 0) {
+            if (i + 2 >= argc) { printf("Incorrect usage of -stencil flag. Please provide a reduction and a list of kernels.\n"); return 1; }
+            stencil = parse_stencil(argv[++i]);
+            if (stencil < 0) { printf("Unknown -stencil reduction %s. Please provide magnitude, max, sumsq or argmax.\n", argv[i]); return 1; }
+            stencil_spec = argv[++i];
+            continue;
+        }
+        if (strcmp(argv[i], "-pipeline") == 0) {
+            if (i + 1 >= argc) { printf("Incorrect usage of -pipeline flag. Please provide a list of stages.\n"); return 1; }
+            pipeline_spec = argv[++i];
+            continue;
+        }
+        if (strcmp(argv[i], "-box") == 0) {
+            box_mode = 1;
+            continue;
+        }
+        if (strcmp(argv[i], "-tiled") == 0) {
+            tiled_mode = 1;
+            continue;
+        }
+        if (strcmp(argv[i], "-sliding") == 0) {
+            sliding_mode = 1;
+            continue;
+        }
+        if (strcmp(argv[i], "-deterministic") == 0) {
+            deterministic_mode = 1;
+            continue;
+        }
+        if (strcmp(argv[i], "-verify") == 0) {
+            verify_mode = 1;
+            if (i + 1 < argc && argv[i + 1][0] != '-') {
+                verify_tolerance = atof(argv[++i]);
+                verify_tolerance_given = 1;
+            }
+            continue;
+        }
+        if (strcmp(argv[i], "-perf") == 0) {
+            perf_mode = 1;
+            continue;
+        }
+        if (strcmp(argv[i], "-hp") == 0) {
+            page_mode = PAGES_TRANSPARENT;
+            if (i + 1 < argc && strcmp(argv[i + 1], "thp") == 0) { i++; continue; }
+            if (i + 1 < argc && strcmp(argv[i + 1], "hugetlb") == 0) { page_mode = PAGES_HUGETLB; i++; }
+            continue;
+        }
+        if (strcmp(argv[i], "-numa") == 0) {
+            numa_mode = 1;
+            continue;
+        }
+        if (strcmp(argv[i], "-fork") == 0) {
+            fork_mode = 1;
+            if (i + 1 < argc && argv[i + 1][0] != '-') { fork_workers = atoi(argv[++i]); }
+            continue;
+        }
         if (strcmp(argv[i], "-t") == 0) {
             if (i + 1 >= argc) { printf("Incorrect usage of -t flag. Please provide a number of threads.\n"); return 1; }
             threads = atoi(argv[++i]) > 0 ? atoi(argv[i]) : 1;
-            omp_set_num_threads(threads);
             continue;
         }
     }
@@ -368,6 +4571,32 @@ int main(int argc, char** argv) {
 
     // ~~~~~~~~~~~~~~~ 2. Error Handling ~~~~~~~~~~~~~~ //
 
+    // Also applies to serial runs, so data generation stays on a single thread there.
+    // With -fork the threads belong to the worker processes, which can't start teams of their own once
+    // this process has one, so everything here runs on one thread.
+    omp_set_num_threads(fork_mode ? 1 : threads);
+
+#ifndef _OPENMP
+    // The pthreads backend's pool stands in for OpenMP's threads
+    if (threads > 1 && !fork_mode && thread_pool_start(threads) != 0){
+        printf("Error starting the thread pool.\n");
+        return 1;
+    }
+#endif
+
+    if (profile_mode || trace_file != NULL) { enable_profiling(); }
+
+    // Pin threads before anything is allocated, so first-touch places every band on its owning node
+    int numa_node_ids[MAX_NUMA_NODES] = { 0 };
+    const int numa_nodes = numa_mode || fork_mode ? read_numa_nodes(numa_node_ids) : 1;
+    if (numa_mode){
+        if (pin_threads_to_nodes(numa_node_ids, numa_nodes) != 0){
+            printf("Error pinning threads to NUMA nodes.\n");
+            return 1;
+        }
+        if (benchmark_mode) { printf("Pinned %d threads across %d NUMA nodes.\n", threads, numa_nodes); }
+    }
+
     if (benchmark_mode) { 
         if (threads > 1){
             printf("Beginning Parallel Convolutions with %d threads...\n", threads);
@@ -386,23 +4615,129 @@ int main(int argc, char** argv) {
         printf("Please provide either a feature map file or dimensions to generate one.\n");
         return 1;
     }
-    if (kH == 0 && kW == 0 && kernel_file == NULL){
+    if ((sliding_mode || tiled_mode || fork_mode) && (sliding_mode + tiled_mode + fork_mode > 1 || dtype != DTYPE_FP32 || quant || deterministic_mode || accumulator != ACCUMULATE_FP32 || gaussian_sigma > 0.0)){
+        printf("-sliding, -tiled and -fork can't be combined with each other, -dtype, -quant, -deterministic, -accumulate or -gaussian.\n");
+        return 1;
+    }
+    if (fork_mode && (threads < 2 || numa_mode || perf_mode || fork_workers < 0)){
+        printf("-fork shares the -t threads between its worker processes, which pin themselves, so it needs -t and can't be combined with -numa or -perf.\n");
+        return 1;
+    }
+    if (gaussian_sigma > 0.0 && (kH != 0 || kW != 0 || kernel_file != NULL)){
+        printf("-gaussian replaces the kernel, so please don't provide one.\n");
+        return 1;
+    }
+    if (gaussian_sigma > 0.0 && (dtype != DTYPE_FP32 || quant || deterministic_mode || accumulator != ACCUMULATE_FP32)){
+        printf("-gaussian can't be combined with -dtype, -quant, -deterministic or -accumulate.\n");
+        return 1;
+    }
+    if (pipeline_spec != NULL && (kH != 0 || kW != 0 || kernel_file != NULL || gaussian_sigma > 0.0)){
+        printf("-pipeline replaces the kernel, so please don't provide one.\n");
+        return 1;
+    }
+    if (pipeline_spec != NULL && (dtype != DTYPE_FP32 || quant || deterministic_mode || accumulator != ACCUMULATE_FP32 || sliding_mode || tiled_mode || fork_mode || box_mode || perf_mode)){
+        printf("-pipeline can't be combined with -dtype, -quant, -deterministic, -accumulate, -sliding, -tiled, -fork, -box or -perf.\n");
+        return 1;
+    }
+    if (epilogue.enabled && (dtype != DTYPE_FP32 || quant || deterministic_mode || accumulator != ACCUMULATE_FP32 || gaussian_sigma > 0.0 || sliding_mode || box_mode || pipeline_spec != NULL)){
+        printf("-epilogue runs inside the default and -tiled engines, so it can't be combined with -dtype, -quant, -deterministic, -accumulate, -gaussian, -sliding, -box or -pipeline.\n");
+        return 1;
+    }
+    if (stencil_spec != NULL && (kH != 0 || kW != 0 || kernel_file != NULL || gaussian_sigma > 0.0 || pipeline_spec != NULL)){
+        printf("-stencil replaces the kernel, so please don't provide one, or a -pipeline.\n");
+        return 1;
+    }
+    if (stencil_spec != NULL && (dtype != DTYPE_FP32 || quant || deterministic_mode || accumulator != ACCUMULATE_FP32 || sliding_mode || tiled_mode || fork_mode || box_mode || perf_mode)){
+        printf("-stencil can't be combined with -dtype, -quant, -deterministic, -accumulate, -sliding, -tiled, -fork, -box or -perf.\n");
+        return 1;
+    }
+    if ((transpose_mode || wgrad_mode) && (transpose_mode + wgrad_mode > 1 || dtype != DTYPE_FP32 || quant || deterministic_mode || accumulator != ACCUMULATE_FP32 || gaussian_sigma > 0.0 || sliding_mode || tiled_mode || fork_mode || box_mode || pipeline_spec != NULL || stencil_spec != NULL || epilogue.enabled || perf_mode)){
+        printf("-transpose and -wgrad can't be combined with each other, -dtype, -quant, -deterministic, -accumulate, -gaussian, -sliding, -tiled, -fork, -box, -pipeline, -stencil, -epilogue or -perf.\n");
+        return 1;
+    }
+    if (kH == 0 && kW == 0 && kernel_file == NULL && gaussian_sigma == 0.0 && pipeline_spec == NULL && stencil_spec == NULL){
         printf("Please provide either a kernel file or dimensions to generate one.\n");
         return 1;
     }
+    if (deterministic_mode && dtype != DTYPE_FP32){
+        printf("Deterministic mode only supports fp32 storage.\n");
+        return 1;
+    }
+    if (quant && (dtype != DTYPE_FP32 || deterministic_mode)){
+        printf("Quantized convolutions can't be combined with -dtype or -deterministic.\n");
+        return 1;
+    }
+    if (accumulator != ACCUMULATE_FP32 && (dtype != DTYPE_FP32 || quant || deterministic_mode)){
+        printf("-accumulate can't be combined with -dtype, -quant or -deterministic.\n");
+        return 1;
+    }
+
+    if (epilogue.enabled) { set_conv2d_epilogue(&epilogue); }
+
+    // Pipeline and stencil kernels are loaded or generated once, for every iteration
+    pipeline_stage pipeline[MAX_PIPELINE_STAGES];
+    int pipeline_count = 0;
+    if (pipeline_spec != NULL && parse_pipeline(pipeline_spec, pipeline, &pipeline_count) != 0){
+        return 1;
+    }
+    if (stencil_spec != NULL){
+        if (parse_pipeline(stencil_spec, pipeline, &pipeline_count) != 0) { return 1; }
+        for (int s = 1; s < pipeline_count; s++){
+            if (pipeline[s].kH != pipeline[0].kH || pipeline[s].kW != pipeline[0].kW){
+                printf("-stencil kernels share each window, so please provide kernels of the same size.\n");
+                return 1;
+            }
+        }
+        for (int s = 0; s < pipeline_count; s++){
+            if (pipeline[s].accumulator != ACCUMULATE_FP32){
+                printf("-stencil kernels accumulate in fp32.\n");
+                return 1;
+            }
+        }
+    }
+
+    // Buffers are allocated once and reused by every iteration, so -mb measures steady-state performance
+    // rather than allocation and page-fault costs. Inputs are only generated on the first iteration.
+    float_buffer kernel_buffer = {0};
+    float_buffer feature_buffer = {0};
+    float_buffer output_buffer = {0};
+    float_buffer half_feature_buffer = {0};     // Only used with -dtype fp16/bf16
+    float_buffer half_output_buffer = {0};
+    float_buffer quant_feature_buffer = {0};    // Only used with -quant
+    float_buffer quant_kernel_buffer = {0};
+    float_buffer quant_output_buffer = {0};
+    float_buffer grad_kernel_buffer = {0};      // Only used with -wgrad
+    quant_config quantization = {0};
+    sparse_tap* sparse_taps = NULL;             // Set when the kernel is sparse enough for sparse_conv2d()
+    int sparse_tap_count = 0;
+    int box_kernel = 0;                         // Set when every tap is the same, for box_conv2d()
+    float box_value = 0.0f;
+    char* output_padding = NULL;
+
+    // Hardware counters, accumulated over every iteration of the convolution region only
+    perf_counts perf_totals = {0};
+    perf_counts* perf_per_thread = perf_mode ? (perf_counts*)calloc(MAX_PERF_THREADS, sizeof(perf_counts)) : NULL;
+    double perf_seconds = 0.0;
+
+    // One worker process per NUMA node unless told otherwise, sharing the threads between them
+    if (fork_mode && fork_workers == 0) { fork_workers = numa_nodes; }
+    fork_worker_stats* fork_stats = fork_mode ? (fork_worker_stats*)calloc(fork_workers, sizeof(fork_worker_stats)) : NULL;
+
+    int verify_failed = 0;
 
     double average_time = 0.0f;
     for (int iteration = 0; iteration < max_iterations; iteration++){
 
-    if (multi_benchmark_mode && (feature_file || kernel_file)) { printf("Do not input a file while running multi-benchmark mode.\n"); return 1; }
 
 
 
     // ~~~~~~~~~~~~~~ 3. Kernel Generation / Extraction ~~~~~~~~~~~~~~ //
 
     float* kernel = NULL;
+    const int first_iteration = iteration == 0;
 
-    // Generate Kernel
+    // Generate Kernel. After the first iteration kH and kW are set, so a kernel read from a file lands here too
+    // and keeps the data already in kernel_buffer rather than reading the file again.
     if (kH > 0 || kW > 0){
 
         // Allows users to specify only 1 dimension, and prevents them from inputting negative numbers
@@ -410,47 +4745,70 @@ int main(int argc, char** argv) {
         kW = max(kW, 1);
 
         // Allocating memory
-        if (posix_memalign((void**)&kernel, 64, kW * kH * sizeof(float)) != 0){
+        if (reserve_buffer(&kernel_buffer, (size_t)kW * kH, page_mode) != 0){
             printf("Error allocating memory for kernel.\n");
             return 1;
         }
+        kernel = kernel_buffer.arr;
 
-        generate_data(kH, kW, &kernel);
+        if (first_iteration){
+            const double phase = profile_begin();
+            if (box_mode){
+                // A mean filter
+                for (int i = 0; i < kH * kW; i++) { kernel[i] = 1.0f / (kH * kW); }
+            } else {
+                generate_data(kH, kW, 0, 0, &kernel);
+            }
+            profile_end("kernel/generate_data", phase);
+        }
 
         // If wanting to save inputs, write to kernel file
-        if (kernel_file != NULL){
-            int status = write_data_to_file(kernel_file, kernel, (float_array){0}, kH, kW, 0, 0);
+        if (kernel_file != NULL && first_iteration){
+            const double phase = profile_begin();
+            // Kernels always stay in fp32
+            int status = is_binary_path(kernel_file)
+                ? write_binary_file(kernel_file, kernel, kH, kW, 0, 0, DTYPE_FP32)
+                : write_data_to_file(kernel_file, kernel, (float_array){0}, kH, kW, 0, 0);
             if (status != 0){
                 printf("Error writing kernel to file.\n");
                 return 1;
             }
+            profile_end("kernel/write_data_to_file", phase);
         }
 
     // Extract Kernel
-    } else if (kernel_file != NULL){
+    } else if (kernel_file != NULL && first_iteration){
 
         // Extracting dimensions
+        double phase = profile_begin();
         if (extract_dimensions(kernel_file, &kH, &kW) != 0){ 
             printf("Error extracting kernel dimensions from file.\n");
             return 1;
         }
+        profile_end("kernel/extract_dimensions", phase);
         
         // Allocating memory
-        if (posix_memalign((void**)&kernel, 64, kW * kH * sizeof(float)) != 0){
+        if (reserve_buffer(&kernel_buffer, (size_t)kW * kH, page_mode) != 0){
             printf("Error allocating memory for kernel.\n");
             return 1;
         }
+        kernel = kernel_buffer.arr;
 
         // Extracting data
+        phase = profile_begin();
         if (extract_data(kernel_file, kW, kH, 0, 0, &kernel) != 0){
             printf("Error extracting kernel data from file.\n");
             return 1;
         }
+        profile_end("kernel/extract_data", phase);
     }
 
-    // This is the "same padding" that'll be added to the feature map.
-    const int padding_width = kW / 2;
-    const int padding_height = kH / 2;
+    // This is the "same padding" that'll be added to the feature map. A pipeline's first stage reads it,
+    // as do all of a stencil's kernels.
+    const int padding_width = (pipeline_count > 0 ? pipeline[0].kW : kW) / 2;
+    const int padding_height = (pipeline_count > 0 ? pipeline[0].kH : kH) / 2;
+
+    if (!verify_tolerance_given) { verify_tolerance = gaussian_sigma > 0.0 ? GAUSSIAN_VERIFY_TOLERANCE : default_verify_tolerance(dtype, kH, kW); }
 
     
     
@@ -458,7 +4816,8 @@ int main(int argc, char** argv) {
 
     float* feature_map = NULL;
 
-    // Generate Feature Map
+    // Generate Feature Map. As with the kernel, a feature map read from a file lands here after the first
+    // iteration and keeps the data already in feature_buffer.
     if (H > 0 || W > 0){
 
         // Allows users to specify only 1 dimension, and prevents them from inputting negative numbers
@@ -469,56 +4828,66 @@ int main(int argc, char** argv) {
         const int total_height = H + padding_height*2;
 
         // Allocating memory
-        if (posix_memalign((void**)&feature_map, 64, total_width * total_height * sizeof(float)) != 0){
+        if (reserve_buffer(&feature_buffer, (size_t)total_width * total_height, page_mode) != 0){
             printf("Error allocating memory for feature map.\n");
             return 1;
         }
+        feature_map = feature_buffer.arr;
 
-        // Add zeroes as padding
-        for (int i = 0; i < total_width * total_height; i++){
-            feature_map[i] = 0.0f;
+        // Generate the interior in parallel; the padding is left as zeroes
+        if (first_iteration){
+            const double phase = profile_begin();
+            generate_data(H, W, padding_height, padding_width, &feature_map);
+            profile_end("feature_map/generate_data", phase);
         }
-        
-
-        generate_data(total_height, total_width, &feature_map);
 
         // If wanting to save inputs, write to feature file
-        if (feature_file != NULL){
-            if (write_data_to_file(feature_file, feature_map, (float_array){0}, H, W, padding_height, padding_width) != 0){
+        if (feature_file != NULL && first_iteration){
+            const double phase = profile_begin();
+            const int status = is_binary_path(feature_file)
+                ? write_binary_file(feature_file, feature_map, H, W, padding_height, padding_width, dtype)
+                : write_data_to_file(feature_file, feature_map, (float_array){0}, H, W, padding_height, padding_width);
+            if (status != 0){
                 printf("Error writing feature map to file.\n");
                 return 1;
             }
+            profile_end("feature_map/write_data_to_file", phase);
         }
 
 
     // Extract Feature Map
-    } else if (feature_file != NULL) {
+    } else if (feature_file != NULL && first_iteration) {
 
         // Extract dimensions of the feature map
+        double phase = profile_begin();
         if (extract_dimensions(feature_file, &H, &W) != 0){ 
             printf("Error extracting feature map dimensions from file.\n");
             return 1;
         }
+        profile_end("feature_map/extract_dimensions", phase);
 
         const int total_width = W + padding_width*2;
         const int total_height = H + padding_height*2;
 
         // Allocate memory for the feature map of the feature map.
-        if (posix_memalign((void**)&feature_map, 64, total_width * total_height * sizeof(float)) != 0){
+        if (reserve_buffer(&feature_buffer, (size_t)total_width * total_height, page_mode) != 0){
             printf("Error allocating memory for feature map.\n");
             return 1;
         }
+        feature_map = feature_buffer.arr;
         
-        // Add zeroes as padding
-        for (int i = 0; i < total_width * total_height; i++){
-            feature_map[i] = 0.0f;
-        }
+        // Add zeroes as padding. Done in parallel so pages are placed near the threads that use them.
+        phase = profile_begin();
+        zero_data(H, W, padding_height, padding_width, &feature_map);
+        profile_end("feature_map/zero_data", phase);
 
         // Extract Feature Map
+        phase = profile_begin();
         if (extract_data(feature_file, W, H, padding_width, padding_height, &feature_map) != 0){
             printf("Error extracting feature map data from file.\n");
             return 1;
-        }        
+        }
+        profile_end("feature_map/extract_data", phase);        
     }
         
 
@@ -526,11 +4895,164 @@ int main(int argc, char** argv) {
     // ~~~~~~~~~~~~~~ 5. Serial Convolutions / Parallel Convolutions ~~~~~~~~~~~~~~ //
     
     // Check if we have all the inputs we need to perform convolutions
-    if (kernel == NULL || feature_map == NULL){
+    if ((kernel == NULL && gaussian_sigma == 0.0 && pipeline_count == 0) || feature_map == NULL){
         printf("To generate an output, please provide all inputs.\n");
         return 1;
     }
 
+    // Kernel gradient. The feature map is the forward pass's input, and the gradient of its outputs is read
+    // from the -wgrad file or generated. The kH x kW gradient is verified and written instead of outputs.
+    if (wgrad_mode){
+
+        if (reserve_buffer(&output_buffer, (size_t)W * H, page_mode) != 0){
+            printf("Error allocating memory for the output gradient.\n");
+            return 1;
+        }
+        float* grad_output = output_buffer.arr;
+
+        if (first_iteration && grad_file != NULL){
+            int grad_H = 0, grad_W = 0;
+            if (extract_dimensions(grad_file, &grad_H, &grad_W) != 0 || grad_H != H || grad_W != W){
+                printf("Please provide an output gradient of the same size as the feature map.\n");
+                return 1;
+            }
+            if (extract_data(grad_file, W, H, 0, 0, &grad_output) != 0){
+                printf("Error extracting output gradient data from file.\n");
+                return 1;
+            }
+        } else if (first_iteration){
+            generate_data(H, W, 0, 0, &grad_output);
+        }
+
+        if (reserve_buffer(&grad_kernel_buffer, (size_t)kH * kW, page_mode) != 0){
+            printf("Error allocating memory for the kernel gradient.\n");
+            return 1;
+        }
+        float* grad_kernel = grad_kernel_buffer.arr;
+
+        const double start_time = omp_get_wtime();
+        const double phase = profile_begin();
+        if (conv2d_weight_grad(feature_map, H, W, grad_output, kH, kW, padding_width, padding_height, grad_kernel) != 0){
+            printf("Error computing the kernel gradient.\n");
+            return 1;
+        }
+        profile_end("conv2d_weight_grad", phase);
+
+        if (benchmark_mode == 1) { printf("%f\n", (omp_get_wtime() - start_time)); }
+        if (multi_benchmark_mode == 1) { average_time += (omp_get_wtime() - start_time); }
+
+        if (verify_mode && first_iteration){
+            verify_failed = verify_weight_grad(feature_map, H, W, grad_output, kH, kW, padding_width, padding_height, grad_kernel, verify_tolerance);
+        }
+
+        if (output_file != NULL && iteration == max_iterations - 1){
+            const int status = is_binary_path(output_file)
+                ? write_binary_file(output_file, grad_kernel, kH, kW, 0, 0, DTYPE_FP32)
+                : write_data_to_file(output_file, grad_kernel, (float_array){0}, kH, kW, 0, 0);
+            if (status != 0){
+                printf("Error writing the kernel gradient to file.\n");
+                return 1;
+            }
+        }
+
+        continue;
+    }
+
+    // Box and sparse kernels. Only the float engines without their own summation order are replaced.
+    const int can_substitute_engine = first_iteration && kernel != NULL && dtype == DTYPE_FP32 && !quant && !deterministic_mode && !sliding_mode && !tiled_mode && !fork_mode && !epilogue.enabled && !transpose_mode && accumulator == ACCUMULATE_FP32;
+    if (can_substitute_engine){
+        box_kernel = is_box_kernel(kernel, kH, kW, &box_value);
+        if (box_kernel && benchmark_mode) { printf("Box kernel: every tap is %g.\n", box_value); }
+    }
+    if (can_substitute_engine && !box_kernel){
+
+        sparse_taps = (sparse_tap*)malloc((size_t)kH * kW * sizeof(sparse_tap));
+        if (sparse_taps == NULL){
+            printf("Error allocating memory for sparse kernel taps.\n");
+            return 1;
+        }
+        sparse_tap_count = build_sparse_taps(kernel, kH, kW, W + padding_width*2, sparse_taps);
+
+        const double density = (double)sparse_tap_count / ((double)kH * kW);
+        if (density < sparse_threshold){
+            if (benchmark_mode) { printf("Sparse kernel: %d of %d taps are nonzero.\n", sparse_tap_count, kH * kW); }
+        } else {
+            free(sparse_taps);
+            sparse_taps = NULL;
+        }
+    }
+
+    // Reduced precision storage. The engine reads a 16-bit copy of the feature map, and the float map is
+    // rounded to the same values, so verification checks the engine against the inputs it actually saw.
+    uint16_t* half_feature_map = NULL;
+    uint16_t* half_outputs = NULL;
+    if (dtype != DTYPE_FP32){
+
+        const int total_width = W + padding_width*2;
+        const int total_height = H + padding_height*2;
+
+        // float_buffer counts floats, and two 16-bit values fit in each
+        if (reserve_buffer(&half_feature_buffer, ((size_t)total_width * total_height + 1) / 2, page_mode) != 0 ||
+            reserve_buffer(&half_output_buffer, ((size_t)W * H + 1) / 2, page_mode) != 0){
+            printf("Error allocating memory for reduced precision buffers.\n");
+            return 1;
+        }
+        half_feature_map = (uint16_t*)half_feature_buffer.arr;
+        half_outputs = (uint16_t*)half_output_buffer.arr;
+
+        if (first_iteration){
+            const double phase = profile_begin();
+
+            #pragma omp parallel for schedule(static)
+            for (int i = 0; i < total_height; i++){
+                convert_float_to_half(feature_map + IDX(i, 0, total_width), half_feature_map + IDX(i, 0, total_width), total_width, dtype);
+                convert_half_to_float(half_feature_map + IDX(i, 0, total_width), feature_map + IDX(i, 0, total_width), total_width, dtype);
+            }
+            profile_end("feature_map/convert_dtype", phase);
+        }
+    }
+
+    // Quantized convolutions. The inputs are quantized once, from the float data, so the error reported
+    // against conv2d() includes the input rounding.
+    void* quant_feature_map = NULL;
+    void* quant_kernel = NULL;
+    void* quant_outputs = NULL;
+    if (quant){
+
+        const int total_width = W + padding_width*2;
+        const int total_height = H + padding_height*2;
+        const size_t element = quant == QUANT_INT8 ? sizeof(uint8_t) : sizeof(int16_t);
+
+        if (first_iteration && prepare_quantization(feature_map, H, W, kernel, kH, kW, padding_width, padding_height, quant, &quantization) != 0){
+            printf("Kernel too large for int32 accumulation of %s products.\n", quant == QUANT_INT8 ? "int8" : "int16");
+            return 1;
+        }
+
+        // The engine may read up to padded_kW - kW elements past the end of the feature map; their taps are zero
+        if (reserve_buffer(&quant_feature_buffer, ((size_t)total_width * total_height + quantization.padded_kW) * element / sizeof(float) + 1, page_mode) != 0 ||
+            reserve_buffer(&quant_kernel_buffer, (size_t)kH * quantization.padded_kW * element / sizeof(float) + 1, page_mode) != 0 ||
+            reserve_buffer(&quant_output_buffer, (size_t)W * H * element / sizeof(float) + 1, page_mode) != 0){
+            printf("Error allocating memory for quantized buffers.\n");
+            return 1;
+        }
+        quant_feature_map = quant_feature_buffer.arr;
+        quant_kernel = quant_kernel_buffer.arr;
+        quant_outputs = quant_output_buffer.arr;
+
+        if (first_iteration){
+            const double phase = profile_begin();
+
+            // The padding quantizes to the feature zero point, which represents 0 exactly
+            #pragma omp parallel for schedule(static)
+            for (int i = 0; i < total_height; i++){
+                quantize_array(feature_map + IDX(i, 0, total_width), (char*)quant_feature_map + IDX(i, 0, total_width) * element, total_width, quantization.feature, quantization.feature_type);
+            }
+            memset((char*)quant_feature_map + (size_t)total_width * total_height * element, 0, quantization.padded_kW * element);
+            quantize_kernel(kernel, kH, kW, quant_kernel, &quantization);
+            profile_end("feature_map/quantize", phase);
+        }
+    }
+
     // Defining output pointers
     float* outputs = NULL;              // Used for serial convolution
     float_array padded_outputs = {0};   // Used for parallel convolution    
@@ -543,38 +5065,135 @@ int main(int argc, char** argv) {
         // Equal to the number of bytes left over in the cache line containing the final element in float array.
         const int cache_padding_size = 64 - ((W * sizeof(float)) % 64);
 
-        if (posix_memalign((void**)&padded_outputs.arr, 64, W * H * sizeof(float)) != 0){
+        if (reserve_buffer(&output_buffer, (size_t)W * H, page_mode) != 0){
             printf("Error allocating memory for padded output.\n");
             return 1;
         }
-        padded_outputs.padding = cache_padding_size == 64 ? NULL : (char*)malloc(cache_padding_size);
+        if (first_iteration && cache_padding_size != 64) { output_padding = (char*)malloc(cache_padding_size); }
+        padded_outputs.arr = output_buffer.arr;
+        padded_outputs.padding = output_padding;
+
+        if (numa_mode && first_iteration){
+            // Touch each output band from its owning node before timing starts
+            zero_data(H, W, 0, 0, &padded_outputs.arr);
+            if (benchmark_mode){
+                report_page_placement("Feature map", feature_map, H + padding_height*2, W + padding_width*2, numa_node_ids, numa_nodes);
+                report_page_placement("Output", padded_outputs.arr, H, W, numa_node_ids, numa_nodes);
+            }
+        }
+
 
+        if (perf_mode) { start_perf_counters(); }
 
         // Timing begins here, because implementation only starts here.
         double start_time = omp_get_wtime();
 
-        if (parallel_conv2d(feature_map, H, W, kernel, kH, kW, padding_width, padding_height, padded_outputs) != 0) {
+        const double phase = profile_begin();
+        const int status = quant
+            ? quantized_conv2d(quant_feature_map, H, W, quant_kernel, kH, kW, padding_width, padding_height, quant_outputs, &quantization)
+            : dtype != DTYPE_FP32
+            ? half_conv2d(half_feature_map, H, W, kernel, kH, kW, padding_width, padding_height, half_outputs, dtype)
+            : accumulator != ACCUMULATE_FP32
+            ? accumulate_conv2d(feature_map, H, W, kernel, kH, kW, padding_width, padding_height, padded_outputs.arr, accumulator)
+            : gaussian_sigma > 0.0
+            ? gaussian_filter(feature_map, H, W, gaussian_sigma, padding_width, padding_height, padded_outputs.arr)
+            : stencil >= 0
+            ? stencil_conv2d(feature_map, H, W, pipeline, pipeline_count, padding_width, padding_height, padded_outputs.arr, stencil)
+            : transpose_mode
+            ? conv2d_transpose(feature_map, H, W, kernel, kH, kW, padding_width, padding_height, padded_outputs.arr)
+            : pipeline_count > 0
+            ? pipeline_conv2d(feature_map, H, W, pipeline, pipeline_count, padding_width, padding_height, padded_outputs.arr)
+            : box_kernel
+            ? box_conv2d(feature_map, H, W, box_value, kH, kW, padding_width, padding_height, padded_outputs.arr)
+            : sparse_taps != NULL
+            ? sparse_conv2d(feature_map, H, W, sparse_taps, sparse_tap_count, padding_width, padding_height, padded_outputs.arr)
+            : tiled_mode
+            ? tiled_conv2d(feature_map, H, W, kernel, kH, kW, padding_width, padding_height, padded_outputs.arr)
+            : sliding_mode
+            ? sliding_conv2d(feature_map, H, W, kernel, kH, kW, padding_width, padding_height, padded_outputs.arr)
+            : fork_mode
+            ? fork_conv2d(feature_map, H, W, kernel, kH, kW, padding_width, padding_height, padded_outputs.arr, fork_workers, max(threads / fork_workers, 1), fork_stats)
+            : deterministic_mode
+            ? deterministic_conv2d(feature_map, H, W, kernel, kH, kW, padding_width, padding_height, padded_outputs.arr)
+#ifdef _OPENMP
+            : parallel_conv2d(feature_map, H, W, kernel, kH, kW, padding_width, padding_height, padded_outputs);
+#else
+            : pool_conv2d(feature_map, H, W, kernel, kH, kW, padding_width, padding_height, padded_outputs.arr);
+#endif
+        if (status != 0) {
             printf("Error performing parallel convolutions.\n");
             return 1;
         }
+        profile_end("parallel_conv2d", phase);
+
+        if (perf_mode){
+            perf_seconds += omp_get_wtime() - start_time;
+            stop_perf_counters(&perf_totals, perf_per_thread);
+        }
 
         if (benchmark_mode == 1) { printf("%f\n", (omp_get_wtime() - start_time));}
         if (multi_benchmark_mode == 1) { average_time += (omp_get_wtime() - start_time); }
+
+        // Each worker's own convolution time, between the barriers, so staging and forking aren't counted
+        if (fork_mode && benchmark_mode){
+            for (int i = 0; i < fork_workers; i++){
+                const fork_worker_stats* worker = &fork_stats[i];
+                const double gflops = 2.0 * worker->rows * W * kH * kW / max(worker->seconds, 1e-9) * 1e-9;
+                printf("    worker %d (node %d): rows %d-%d, %f s, %.2f GFLOP/s\n", i, worker->node,
+                    worker->first_row, worker->first_row + worker->rows - 1, worker->seconds, gflops);
+            }
+        }
         
     // Serial Convolutions
     } else {
 
-        if (posix_memalign((void**)&outputs, 64, W * H * sizeof(float)) != 0){
+        if (reserve_buffer(&output_buffer, (size_t)W * H, page_mode) != 0){
             printf("Error allocating memory for outputs.\n");
             return 1;
         }
+        outputs = output_buffer.arr;
+
+        if (perf_mode) { start_perf_counters(); }
 
         double start_time = omp_get_wtime();
 
-        if (conv2d(feature_map, H, W, kernel, kH, kW, padding_width, padding_height, outputs) != 0){
+        // The deterministic engine gives the same bits with one thread as with many
+        const double phase = profile_begin();
+        const int status = quant
+            ? quantized_conv2d(quant_feature_map, H, W, quant_kernel, kH, kW, padding_width, padding_height, quant_outputs, &quantization)
+            : dtype != DTYPE_FP32
+            ? half_conv2d(half_feature_map, H, W, kernel, kH, kW, padding_width, padding_height, half_outputs, dtype)
+            : accumulator != ACCUMULATE_FP32
+            ? accumulate_conv2d(feature_map, H, W, kernel, kH, kW, padding_width, padding_height, outputs, accumulator)
+            : gaussian_sigma > 0.0
+            ? gaussian_filter(feature_map, H, W, gaussian_sigma, padding_width, padding_height, outputs)
+            : stencil >= 0
+            ? stencil_conv2d(feature_map, H, W, pipeline, pipeline_count, padding_width, padding_height, outputs, stencil)
+            : transpose_mode
+            ? conv2d_transpose(feature_map, H, W, kernel, kH, kW, padding_width, padding_height, outputs)
+            : pipeline_count > 0
+            ? pipeline_conv2d(feature_map, H, W, pipeline, pipeline_count, padding_width, padding_height, outputs)
+            : box_kernel
+            ? box_conv2d(feature_map, H, W, box_value, kH, kW, padding_width, padding_height, outputs)
+            : sparse_taps != NULL
+            ? sparse_conv2d(feature_map, H, W, sparse_taps, sparse_tap_count, padding_width, padding_height, outputs)
+            : tiled_mode
+            ? tiled_conv2d(feature_map, H, W, kernel, kH, kW, padding_width, padding_height, outputs)
+            : sliding_mode
+            ? sliding_conv2d(feature_map, H, W, kernel, kH, kW, padding_width, padding_height, outputs)
+            : deterministic_mode
+            ? deterministic_conv2d(feature_map, H, W, kernel, kH, kW, padding_width, padding_height, outputs)
+            : conv2d(feature_map, H, W, kernel, kH, kW, padding_width, padding_height, outputs);
+        if (status != 0){
             printf("Error performing serial convolutions.\n");
             return 1;
         }
+        profile_end("conv2d", phase);
+
+        if (perf_mode){
+            perf_seconds += omp_get_wtime() - start_time;
+            stop_perf_counters(&perf_totals, perf_per_thread);
+        }
 
         // Benchmarking
         if (benchmark_mode == 1) {printf("%f\n", (omp_get_wtime() - start_time)); }
@@ -584,28 +5203,158 @@ int main(int argc, char** argv) {
         
 
 
-    // ~~~~~~~~~~~~~~ 6. Write to Output ~~~~~~~~~~~~~~ //
+    // Widen reduced precision outputs, so writing and verification work as usual
+    if (dtype != DTYPE_FP32){
+        convert_half_to_float(half_outputs, output_buffer.arr, (size_t)W * H, dtype);
+    }
+    if (quant){
+        dequantize_array(quant_outputs, output_buffer.arr, (size_t)W * H, quantization.output, quantization.feature_type);
+    }
 
-    if (output_file != NULL){
+    // Quantization error against the float engine, on the original float inputs
+    if (quant && first_iteration){
+        float* reference = (float*)malloc((size_t)W * H * sizeof(float));
+        if (reference == NULL){
+            printf("Error allocating memory for the float reference.\n");
+            return 1;
+        }
+        conv2d(feature_map, H, W, kernel, kH, kW, padding_width, padding_height, reference);
+        report_quantization_error(reference, output_buffer.arr, (size_t)W * H, &quantization);
+        free(reference);
+    }
 
-        if (write_data_to_file(output_file, outputs, padded_outputs, H, W, 0, 0) != 0){
-            printf("Error writing outputs to file.\n");
+    if (benchmark_mode && page_mode != PAGES_DEFAULT && first_iteration){
+        report_page_size("Feature map", feature_map);
+        report_page_size("Output", output_buffer.arr);
+    }
+
+    // Check whichever engine ran against the high precision reference. A pipeline's last stage is checked
+    // on the outputs of the stages before it, run separately. A stencil's kernels are held as pipeline stages.
+    if (verify_mode && first_iteration && stencil >= 0){
+        const int status = verify_stencil(feature_map, H, W, pipeline, pipeline_count, padding_width, padding_height, output_buffer.arr, stencil, verify_tolerance);
+        if (status == 2){
+            printf("Error allocating memory for verification.\n");
+            return 1;
+        }
+        verify_failed = status;
+    } else if (verify_mode && first_iteration && pipeline_count > 0){
+        float* last_input = NULL;
+        const pipeline_stage* last = &pipeline[pipeline_count - 1];
+        const int status = unfused_pipeline(feature_map, H, W, pipeline, pipeline_count, padding_width, padding_height, &last_input) != 0 ? 2
+            : verify_outputs(last_input, H, W, last->g, last->kH, last->kW, last->kW / 2, last->kH / 2, output_buffer.arr, verify_tolerance, 0.0);
+        if (last_input != feature_map) { free(last_input); }
+        if (status == 2){
+            printf("Error allocating memory for verification.\n");
+            return 1;
+        }
+        verify_failed = status;
+    } else if (verify_mode && first_iteration && transpose_mode){
+        // The transposed convolution is a forward one with the flipped kernel
+        int fH = 0, fW = 0;
+        float* flipped = flip_kernel(kernel, kH, kW, &fH, &fW);
+        const int status = flipped == NULL ? 2
+            : verify_outputs(feature_map, H, W, flipped, fH, fW, padding_width, padding_height, output_buffer.arr, verify_tolerance, 0.0);
+        free(flipped);
+        if (status == 2){
+            printf("Error allocating memory for verification.\n");
+            return 1;
+        }
+        verify_failed = status;
+    } else if (verify_mode && first_iteration && gaussian_sigma > 0.0){
+        const int status = verify_gaussian(feature_map, H, W, gaussian_sigma, padding_width, padding_height, output_buffer.arr, verify_tolerance);
+        if (status == 2){
+            printf("Error allocating memory for verification.\n");
+            return 1;
+        }
+        verify_failed = status;
+    } else if (verify_mode && first_iteration && quant){
+        // The quantized engine is checked on the inputs it actually saw, dequantized, so that what's left
+        // is the requantization of the outputs: up to half an output step, and one step is allowed
+        const int total_width = W + padding_width*2;
+        const size_t total = (size_t)total_width * (H + padding_height*2);
+        const size_t kernel_element = quantization.kernel_type == QTYPE_INT8 ? sizeof(int8_t) : sizeof(int16_t);
+        float* dequantized_f = (float*)malloc(total * sizeof(float));
+        float* dequantized_g = (float*)malloc((size_t)kH * kW * sizeof(float));
+        int status = 2;
+        if (dequantized_f != NULL && dequantized_g != NULL){
+            dequantize_array(quant_feature_map, dequantized_f, total, quantization.feature, quantization.feature_type);
+            for (int i = 0; i < kH; i++){
+                dequantize_array((char*)quant_kernel + (size_t)i * quantization.padded_kW * kernel_element, dequantized_g + IDX(i, 0, kW), kW, quantization.kernel, quantization.kernel_type);
+            }
+            status = verify_outputs(dequantized_f, H, W, dequantized_g, kH, kW, padding_width, padding_height, output_buffer.arr, verify_tolerance, quantization.output.scale);
+        }
+        free(dequantized_f);
+        free(dequantized_g);
+        if (status == 2){
+            printf("Error allocating memory for verification.\n");
             return 1;
         }
+        verify_failed = status;
+    } else if (verify_mode && first_iteration){
+        const int status = verify_outputs(feature_map, H, W, kernel, kH, kW, padding_width, padding_height, output_buffer.arr, verify_tolerance, 0.0);
+        if (status == 2){
+            printf("Error allocating memory for verification.\n");
+            return 1;
+        }
+        verify_failed = status;
+    }
+
 
-        // Free any remaining memory
-        if (outputs != NULL) {free(outputs); outputs = NULL;}
-        if (padded_outputs.arr != NULL) { free(padded_outputs.arr); padded_outputs.arr = NULL; }
-        if (padded_outputs.padding != NULL) { free(padded_outputs.padding); padded_outputs.padding = NULL;}
+    // ~~~~~~~~~~~~~~ 6. Write to Output ~~~~~~~~~~~~~~ //
+
+    // Every iteration computes the same outputs, so only the last one is written
+    if (output_file != NULL && iteration == max_iterations - 1){
 
+        const double phase = profile_begin();
+        const int status = is_binary_path(output_file)
+            ? write_binary_file(output_file, output_buffer.arr, H, W, 0, 0, dtype)
+            : write_data_to_file(output_file, outputs, padded_outputs, H, W, 0, 0);
+        if (status != 0){
+            printf("Error writing outputs to file.\n");
+            return 1;
+        }
+        profile_end("output/write_data_to_file", phase);
     }
-    
-    if (feature_map != NULL) {free(feature_map); feature_map = NULL; }
-    if (kernel != NULL) {free(kernel); kernel = NULL; }
 
     } // End of loop for multi_benchmark_mode
 
+    // Free any remaining memory
+    if (sparse_taps != NULL) { free(sparse_taps); }
+    release_buffer(&grad_kernel_buffer);
+    release_buffer(&quant_output_buffer);
+    release_buffer(&quant_kernel_buffer);
+    release_buffer(&quant_feature_buffer);
+    release_buffer(&half_output_buffer);
+    release_buffer(&half_feature_buffer);
+    release_buffer(&output_buffer);
+    release_buffer(&feature_buffer);
+    release_buffer(&kernel_buffer);
+    if (output_padding != NULL) { free(output_padding); output_padding = NULL; }
+
     if (multi_benchmark_mode == 1) {printf("Average Time:   %f\n", average_time/max_iterations);}
 
+    if (profile_mode) { print_profile_summary(); }
+
+    if (perf_mode){
+        // One multiply and one add per kernel tap, over every iteration. The compulsory traffic is
+        // reading the padded feature map and kernel, and writing the outputs.
+        const double flops = 2.0 * H * W * kH * kW * max_iterations;
+        const double bytes = sizeof(float) * ((double)(H + kH / 2 * 2) * (W + kW / 2 * 2) + (double)kH * kW + (double)H * W) * max_iterations;
+        print_perf_report(&perf_totals, perf_per_thread, threads, perf_seconds, flops, bytes);
+        free(perf_per_thread);
+    }
+    if (trace_file != NULL && write_profile_trace(trace_file) != 0){
+        printf("Error writing trace to file.\n");
+        return 1;
+    }
+
+    thread_pool_stop();
+    free(fork_stats);
+    for (int s = 0; s < pipeline_count; s++) { free(pipeline[s].g); }
+
+    if (verify_failed) { return 1; }
+
     return 0;
-}
\ No newline at end of file
+}
+
+#endif // CONV2D_NO_MAIN
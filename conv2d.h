@@ -0,0 +1,476 @@
+// Name: Liam Hearder       Student Number: 23074422
+// Name: Pranav Menon       Student Number: 24069351
+
+// Shared declarations for the convolution engines in conv2d.c, so that other programs (such as the
+// benchmark harness in bench.c) can be built on the same code. Documentation lives with each definition.
+
+#ifndef CONV2D_H
+#define CONV2D_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <pthread.h>
+
+// The threading backend is chosen at compile time: OpenMP by default, or a pthreads pool with
+// `make BACKEND=pthreads`, which builds without OpenMP. The OpenMP runtime calls then have single-threaded
+// stand-ins, and parallel runs use pool_conv2d(). omp_get_max_threads() still returns what omp_set_num_threads()
+// was given (the processor count before that), and pool_conv2d() starts its pool at that size.
+#ifdef _OPENMP
+#include <omp.h>
+#else
+double omp_get_wtime();
+int omp_get_thread_num();
+int omp_get_num_threads();
+int omp_get_max_threads();
+int omp_get_num_procs();
+void omp_set_num_threads(int threads);
+#endif
+
+// Macros for max, min,
+#define max(a,b) (((a) > (b)) ? (a) : (b))
+#define min(a,b) (((a) < (b)) ? (a) : (b))
+
+// Buffers at least this large may be backed by huge pages (-hp)
+#define HUGE_PAGE_SIZE (2 * 1024 * 1024)
+
+// Page backing modes for reserve_buffer()
+#define PAGES_DEFAULT 0         // Regular 4 KB pages, faulted in on first touch
+#define PAGES_TRANSPARENT 1     // madvise(MADV_HUGEPAGE), pre-faulted in parallel
+#define PAGES_HUGETLB 2         // mmap(MAP_HUGETLB) from the hugetlbfs pool, pre-faulted in parallel
+
+// The most NUMA nodes read_numa_nodes() will report
+#define MAX_NUMA_NODES 256
+
+// Macro for converting 2D indices to 1D index
+#define IDX(row, col, step) ((row) * (step) + (col))
+
+// The most timed events kept by the profiler. Later events are counted but dropped.
+#define MAX_PROFILE_EVENTS 8192
+
+// One timed region, as recorded by profile_end()
+typedef struct {
+    const char* name;
+    int thread;             // OpenMP thread number, or 0 outside parallel regions
+    double start, end;      // Seconds since profiling was enabled
+} profile_event;
+
+// Output columns processed together by deterministic_conv2d(), sized so the accumulators stay in L1
+#define DETERMINISTIC_BLOCK 512
+
+// Output columns processed together by sliding_conv2d(), which keeps kH rows of partial sums this wide
+#define SLIDING_BLOCK 256
+
+// Output tiles scheduled by tiled_conv2d(). Wide enough for full vectors, short enough for many tiles.
+#define TILE_HEIGHT 32
+#define TILE_WIDTH 256
+
+// One output tile, and its position along the Hilbert curve
+typedef struct {
+    int row, column;
+    long long order;
+} conv_tile;
+
+// Computes one output tile; the other parameters are those of the convolution engines
+typedef void (*conv_tile_function)(float* f, int H, int W, float* g, int kH, int kW, int w_padding, int h_padding, float* output, conv_tile tile);
+
+// A thread's remaining run of tiles, as head << 32 | tail, so the owner and thieves can both take tiles
+// with a single compare-and-swap. Aligned to its own cache line.
+typedef struct {
+    _Alignas(64) _Atomic uint64_t range;
+} tile_deque;
+
+// Cells in the thread pool's task queue. Larger jobs are fed in as tasks complete.
+#define POOL_QUEUE_CAPACITY 4096
+
+// One cell of the bounded MPMC queue: the task number, and the sequence that says whose turn it is
+typedef struct {
+    _Alignas(64) _Atomic size_t sequence;
+    int value;
+} mpmc_cell;
+
+// A bounded, lock-free, multi-producer multi-consumer queue of task numbers
+typedef struct {
+    mpmc_cell* cells;
+    size_t mask;                                    // Capacity - 1; the capacity is a power of two
+    _Alignas(64) _Atomic size_t enqueue_position;
+    _Alignas(64) _Atomic size_t dequeue_position;
+} mpmc_queue;
+
+// Runs task number `task` of a job
+typedef void (*conv2d_task)(void* job, int task);
+
+// Runs run(job, t) for every t in [0, task_count), on any threads, returning when they've all finished.
+// Hosts with their own thread pools can supply one with set_conv2d_executor().
+typedef void (*conv2d_executor)(void* context, conv2d_task run, void* job, int task_count);
+
+// The built-in pthreads pool. Workers sleep on `work` until `generation` changes, then drain the queue
+// until every task of the job has been queued and taken.
+typedef struct {
+    mpmc_queue queue;
+    pthread_t* workers;
+    int thread_count;                   // Including the submitting thread
+    int running, stopping;
+    long long generation;               // Bumped for every job
+    conv2d_task run;                    // The current job
+    void* job;
+    _Atomic int pending;                // Tasks of the current job not yet finished
+    _Atomic int unqueued;               // Tasks of the current job not yet pushed onto the queue
+    pthread_mutex_t lock;
+    pthread_cond_t work, done;
+} thread_pool;
+
+// The arguments of a run_tiles() call, shared by its tiles, and the function that computes each one
+typedef struct {
+    conv_tile_function run_tile;
+    float* f;
+    int H, W;
+    float* g;
+    int kH, kW, w_padding, h_padding;
+    float* output;
+    conv_tile* tiles;
+} tile_job;
+
+// Accumulator policies for accumulate_conv2d() (-accumulate)
+#define ACCUMULATE_FP32 0
+#define ACCUMULATE_FP64 1
+#define ACCUMULATE_PAIRWISE 2
+#define ACCUMULATE_KAHAN 3
+
+// Output columns processed together by accumulate_conv2d(). Smaller than the other blocks, since the
+// pairwise tree keeps several rows of partial sums per block.
+#define ACCUMULATE_BLOCK 256
+
+// Taps summed sequentially before the pairwise tree takes over
+#define PAIRWISE_CHUNK 8
+
+// Kernels with less than this fraction of nonzero taps use sparse_conv2d(), unless -sparse says otherwise.
+// Low enough that dense kernels keep their engine, high enough to catch 3x3 Laplacian and Sobel stencils.
+#define SPARSE_DENSITY_THRESHOLD 0.75
+
+// Output columns processed together by sparse_conv2d()
+#define SPARSE_BLOCK 512
+
+// One nonzero kernel tap: its weight, and its input's offset from the output's centre in the padded Feature Map
+typedef struct {
+    int offset;
+    float weight;
+} sparse_tap;
+
+// Rows filtered together by gaussian_filter()'s horizontal pass, as one vector per step, and columns by
+// its vertical pass
+#define GAUSSIAN_ROWS 16
+#define GAUSSIAN_COLUMNS 64
+
+// Below this sigma the three-pole recursion is a poor fit to a sampled Gaussian, so a small kernel should be used instead
+#define GAUSSIAN_MIN_SIGMA 1.5
+
+// The poles of van Vliet, Young and Verbeek's third-order recursive Gaussian, optimised in the L-infinity
+// norm: a complex pair and one real pole, for q = 1
+#define GAUSSIAN_POLE_REAL 1.40098
+#define GAUSSIAN_POLE_IMAGINARY 1.00236
+#define GAUSSIAN_POLE_SINGLE 1.85132
+
+// -verify compares -gaussian with a sampled kernel truncated at this many sigmas, and by default allows
+// this much normalised error. The three-pole recursion is only an approximation: the peak of its 2D response
+// is 5.6% off at GAUSSIAN_MIN_SIGMA, falling to 2% at large sigmas, and noisy maps stay below 3%.
+#define GAUSSIAN_VERIFY_RADIUS 5.0
+#define GAUSSIAN_VERIFY_TOLERANCE 0.075
+
+// When building the boundary matrix, the causal response is treated as over once below this, and is never
+// run longer
+#define GAUSSIAN_TAIL_TOLERANCE 1e-12
+#define GAUSSIAN_MAX_TAIL 100000
+
+// Recursive Gaussian: y[n] = gain * x[n] + a1 * y[n-1] + a2 * y[n-2] + a3 * y[n-3], run forwards then
+// backwards
+typedef struct {
+    double gain, a1, a2, a3;
+    double boundary[9];     // Triggs-Sdika matrix: the anticausal pass's first state from the causal pass's last outputs
+} gaussian_coefficients;
+
+// The most convolutions one -pipeline can chain
+#define MAX_PIPELINE_STAGES 8
+
+// One convolution of a -pipeline, with its own kernel and accumulator (ACCUMULATE_FP32 or ACCUMULATE_FP64)
+typedef struct {
+    float* g;
+    int kH, kW;
+    int accumulator;
+} pipeline_stage;
+
+// The arguments of a pipeline_conv2d() call, shared by its tiles
+typedef struct {
+    float* f;
+    int H, W;
+    pipeline_stage* stages;
+    int stage_count, w_padding, h_padding;
+    float* output;
+    conv_tile* tiles;
+    int buffer_width;           // Of the widest intermediate, the first stage's
+    size_t buffer_floats;       // Of each of the two intermediate buffers
+    size_t scratch_bytes;       // Per thread: both buffers, then one row of doubles for fp64 stages
+    _Atomic int failed;
+} pipeline_job;
+
+// The arguments of a conv2d_weight_grad() call, shared by its tasks, each of which sums a contiguous run of
+// tiles into its own partial
+typedef struct {
+    float* f;
+    int H, W;
+    float* grad_output;
+    int kH, kW, w_padding, h_padding;
+    conv_tile* tiles;
+    int tile_count, task_count;
+    double* partials;           // task_count kH x kW accumulators...
+    size_t stride;              // ...each starting on its own cache line
+} weight_grad_job;
+
+// Ways stencil_conv2d() (-stencil) combines the responses of several kernels into one output
+#define STENCIL_MAGNITUDE 0
+#define STENCIL_MAX 1
+#define STENCIL_SUM_SQUARES 2
+#define STENCIL_ARGMAX 3
+
+// Output columns stencil_conv2d() accumulates together, one row of responses per kernel, sized for L1
+#define STENCIL_BLOCK 256
+
+// Storage types for feature maps and outputs (-dtype), also recorded in binary file headers
+#define DTYPE_FP32 0
+#define DTYPE_FP16 1            // IEEE 754 half precision
+#define DTYPE_BF16 2            // bfloat16: the top 16 bits of a float32
+
+// Binary files start with this magic, then the dtype, height and width as 32-bit integers, then the data
+#define BINARY_MAGIC "CV2D"
+#define BINARY_HEADER_SIZE 16
+
+// Output columns processed together by half_conv2d(), so the fp32 accumulators and converted input stay in L1
+#define HALF_BLOCK 512
+
+// Quantized convolutions (-quant)
+#define QUANT_INT8 8            // uint8 feature map and outputs, int8 kernel
+#define QUANT_INT16 16          // int16 throughout
+
+// Element types of quantized arrays
+#define QTYPE_UINT8 0
+#define QTYPE_INT8 1
+#define QTYPE_INT16 2
+
+// Output columns processed together by quantized_conv2d(), so the int32 accumulators stay in L1
+#define QUANT_BLOCK 512
+
+// Per-tensor affine quantization: real = scale * (quantized - zero_point)
+typedef struct {
+    float scale;
+    int zero_point;
+} quant_params;
+
+// Everything quantized_conv2d() needs to know about its inputs and outputs
+typedef struct {
+    int quant;                  // QUANT_INT8 or QUANT_INT16
+    int feature_type;           // QTYPE_ of the feature map and outputs
+    int kernel_type;            // QTYPE_ of the kernel
+    int padded_kW;              // Kernel row length, rounded up to the taps per SIMD dot product; extra taps are zero
+    int kernel_sum;             // Sum of the quantized taps, for the feature zero point correction
+    quant_params feature, kernel, output;
+} quant_config;
+
+// Default tolerance for -verify of fp32 outputs: the largest error allowed, relative to the sum of |f * g|
+// over the window. Reduced precision outputs get a wider one, from default_verify_tolerance().
+#define DEFAULT_VERIFY_TOLERANCE 1e-5
+
+// Counters collected by -perf, as indices into perf_counts.values
+#define PERF_CYCLES 0
+#define PERF_INSTRUCTIONS 1
+#define PERF_L1D_MISSES 2
+#define PERF_LLC_MISSES 3
+#define PERF_DTLB_MISSES 4
+#define PERF_FP_SCALAR 5        // The FP_ counters are Intel-only raw events, counting single precision
+#define PERF_FP_128 6           // instructions by vector width
+#define PERF_FP_256 7
+#define PERF_FP_512 8
+#define PERF_TASK_CLOCK 9       // Nanoseconds on CPU. A software counter, so usually available in VMs too.
+#define PERF_COUNTER_COUNT 10
+
+// The most threads that can be counted at once
+#define MAX_PERF_THREADS 256
+
+// Counter totals, scaled for multiplexing. -1 marks a counter that couldn't be opened.
+typedef struct {
+    long long values[PERF_COUNTER_COUNT];
+} perf_counts;
+
+// A barrier for fork_conv2d()'s worker processes and their parent, placed in a MAP_SHARED mapping
+typedef struct {
+    _Alignas(64) _Atomic int arrived;
+    _Atomic int generation;
+    _Atomic int failed;     // Set by any worker that couldn't pin itself or convolve its band
+    int parties;
+} process_barrier;
+
+// The band one fork_conv2d() worker convolved, and how long it took
+typedef struct {
+    int node;
+    int first_row;
+    int rows;
+    double seconds;
+} fork_worker_stats;
+
+// Pointwise operations applied to each output before it's stored (-epilogue)
+#define EPILOGUE_NONE 0
+#define EPILOGUE_RELU 1
+#define EPILOGUE_LEAKY 2
+#define EPILOGUE_CLAMP 3
+#define EPILOGUE_ABS 4
+#define EPILOGUE_SQUARE 5
+
+// An output is scaled, biased, passed through one EPILOGUE_ activation, then optionally quantized
+typedef struct {
+    int enabled;
+    float scale, bias;
+    int activation;
+    float slope;                    // EPILOGUE_LEAKY's gradient below zero
+    float low, high;                // EPILOGUE_CLAMP's bounds
+    float quant_step;               // Quantizes to multiples of the step when non-zero...
+    float quant_min, quant_max;     // ...saturating at these codes
+} conv_epilogue;
+
+// A struct to hold a float array and its padding, to prevent false sharing.
+typedef struct {
+    float* arr;
+    char* padding;
+} float_array;
+
+// A 64-byte aligned buffer that only ever grows. Reserving it again for the same or a smaller size
+// reuses the existing allocation, so repeated iterations and jobs keep their pages resident.
+typedef struct {
+    float* arr;
+    size_t capacity;        // In floats
+    size_t mapped_bytes;    // Non-zero when arr came from mmap() rather than posix_memalign()
+} float_buffer;
+
+
+// File I/O
+int extract_dimensions(char* filepath, int* height, int* width);
+int extract_data(char* filepath, int width, int height, int padding_width, int padding_height, float* *output);
+int write_data_to_file(char* filepath, float* outputs, float_array padded_outputs, int h_dimension, int w_dimension, int h_padding, int w_padding);
+
+// Convolution engines
+extern conv_epilogue conv2d_epilogue;
+int parse_epilogue(char* spec, conv_epilogue* epilogue);
+void set_conv2d_epilogue(const conv_epilogue* epilogue);
+float apply_epilogue(float value, const conv_epilogue* e);
+void apply_epilogue_row(float* values, int count, const conv_epilogue* e);
+double apply_epilogue_reference(double* reference, double* magnitude, size_t count, const conv_epilogue* e);
+int conv2d(float* f, int H, int W, float* g, int kH, int kW, int w_padding, int h_padding, float* output);
+int parallel_conv2d(float* f, int H, int W, float* g, int kH, int kW, int w_padding, int h_padding, float_array padded_output);
+int deterministic_conv2d(float* f, int H, int W, float* g, int kH, int kW, int w_padding, int h_padding, float* output);
+int sliding_conv2d(float* f, int H, int W, float* g, int kH, int kW, int w_padding, int h_padding, float* output);
+long long hilbert_index(int side, int x, int y);
+int build_tile_order(int H, int W, conv_tile* *tiles);
+int pop_tile(tile_deque* deque);
+int steal_tiles(tile_deque* victim, tile_deque* own);
+void convolve_tile(float* f, int H, int W, float* g, int kH, int kW, int w_padding, int h_padding, float* output, conv_tile tile);
+int tiled_conv2d(float* f, int H, int W, float* g, int kH, int kW, int w_padding, int h_padding, float* output);
+int run_tiles(conv_tile_function run_tile, float* f, int H, int W, float* g, int kH, int kW, int w_padding, int h_padding, float* output, int on_pool);
+int pool_conv2d(float* f, int H, int W, float* g, int kH, int kW, int w_padding, int h_padding, float* output);
+int parse_accumulator(const char* name);
+int build_sparse_taps(float* g, int kH, int kW, int total_width, sparse_tap* taps);
+int sparse_conv2d(float* f, int H, int W, sparse_tap* taps, int tap_count, int w_padding, int h_padding, float* output);
+int is_box_kernel(float* g, int kH, int kW, float* value);
+int box_conv2d(float* f, int H, int W, float value, int kH, int kW, int w_padding, int h_padding, float* output);
+int gaussian_iir_coefficients(double sigma, gaussian_coefficients* c);
+void gaussian_iir_boundary(const gaussian_coefficients* c, double w1, double w2, double w3, double* y1, double* y2, double* y3);
+void gaussian_iir_band(float* band, int length, const gaussian_coefficients* c);
+int gaussian_filter(float* f, int H, int W, double sigma, int w_padding, int h_padding, float* output);
+int parse_pipeline(char* spec, pipeline_stage* stages, int* stage_count);
+void convolve_fused_tile(pipeline_job* job, conv_tile tile, float* scratch);
+int pipeline_conv2d(float* f, int H, int W, pipeline_stage* stages, int stage_count, int w_padding, int h_padding, float* output);
+int unfused_pipeline(float* f, int H, int W, pipeline_stage* stages, int stage_count, int w_padding, int h_padding, float** last_input);
+int parse_stencil(const char* name);
+int stencil_conv2d(float* f, int H, int W, pipeline_stage* kernels, int kernel_count, int w_padding, int h_padding, float* output, int reduction);
+void transpose_tile(float* f, int H, int W, float* g, int kH, int kW, int w_padding, int h_padding, float* output, conv_tile tile);
+int conv2d_transpose(float* f, int H, int W, float* g, int kH, int kW, int w_padding, int h_padding, float* output);
+void weight_grad_tiles(const weight_grad_job* job, int first_tile, int last_tile, double* partial);
+void weight_grad_task(void* job, int task);
+int conv2d_weight_grad(float* f, int H, int W, float* grad_output, int kH, int kW, int w_padding, int h_padding, float* grad_kernel);
+int accumulate_conv2d(float* f, int H, int W, float* g, int kH, int kW, int w_padding, int h_padding, float* output, int policy);
+
+// Binary I/O
+int read_binary_header(char* filepath, int* dtype, int* height, int* width);
+int is_binary_path(char* filepath);
+int extract_binary_data(char* filepath, int width, int height, int padding_width, int padding_height, float* *output);
+int write_binary_file(char* filepath, float* data, int h_dimension, int w_dimension, int h_padding, int w_padding, int dtype);
+
+// Reduced precision storage
+int parse_dtype(const char* name);
+size_t dtype_size(int dtype);
+float half_to_float(uint16_t value, int dtype);
+uint16_t float_to_half(float value, int dtype);
+void convert_half_to_float(const uint16_t* src, float* dst, size_t count, int dtype);
+void convert_float_to_half(const float* src, uint16_t* dst, size_t count, int dtype);
+int half_conv2d(uint16_t* f, int H, int W, float* g, int kH, int kW, int w_padding, int h_padding, uint16_t* output, int dtype);
+
+// Quantization
+int parse_quant(const char* name);
+void quant_range(int qtype, int* qmin, int* qmax);
+quant_params choose_quant_params(float lo, float hi, int qmin, int qmax);
+void quantize_array(const float* src, void* dst, size_t count, quant_params params, int qtype);
+void dequantize_array(const void* src, float* dst, size_t count, quant_params params, int qtype);
+int prepare_quantization(float* f, int H, int W, float* g, int kH, int kW, int w_padding, int h_padding, int quant, quant_config* config);
+void quantize_kernel(float* g, int kH, int kW, void* quantized, quant_config* config);
+int quantized_conv2d(void* f, int H, int W, void* g, int kH, int kW, int w_padding, int h_padding, void* output, const quant_config* config);
+int report_quantization_error(float* reference, float* output, size_t count, const quant_config* config);
+
+// Thread pool backend
+int mpmc_init(mpmc_queue* queue, size_t capacity);
+int mpmc_push(mpmc_queue* queue, int value);
+int mpmc_pop(mpmc_queue* queue);
+int thread_pool_start(int threads);
+void thread_pool_stop();
+void pool_execute(void* context, conv2d_task run, void* job, int task_count);
+void set_conv2d_executor(conv2d_executor executor, void* context);
+
+// Data initialisation
+int generate_data(int height, int width, int padding_height, int padding_width, float* *output);
+int generate_rows(unsigned int seed, int first_row, int height, int width, int padding_height, int padding_width, float* *output);
+int zero_data(int height, int width, int padding_height, int padding_width, float* *output);
+
+// Memory
+int reserve_buffer(float_buffer* buffer, size_t count, int page_mode);
+void release_buffer(float_buffer* buffer);
+int report_page_size(const char* name, void* arr);
+
+// NUMA
+int read_numa_nodes(int* node_ids);
+int pin_threads_to_nodes(const int* node_ids, int nodes);
+int report_page_placement(const char* name, float* arr, int height, int width, const int* node_ids, int nodes);
+void process_barrier_init(process_barrier* barrier, int parties);
+void process_barrier_wait(process_barrier* barrier);
+int fork_conv2d(float* f, int H, int W, float* g, int kH, int kW, int w_padding, int h_padding, float* output,
+    int workers, int team_size, fork_worker_stats* stats);
+
+// Instrumentation
+extern int profiling_enabled;
+void enable_profiling();
+double profile_begin();
+void profile_end(const char* name, double start);
+int print_profile_summary();
+int write_profile_trace(char* filepath);
+
+// Verification
+int reference_conv2d(float* f, int H, int W, float* g, int kH, int kW, int w_padding, int h_padding, double* output, double* magnitude);
+double default_verify_tolerance(int dtype, int kH, int kW);
+int report_verification(const char* title, double* reference, double* magnitude, float* output, int H, int W, double tolerance, double absolute);
+int verify_outputs(float* f, int H, int W, float* g, int kH, int kW, int w_padding, int h_padding, float* output, double tolerance, double absolute);
+int verify_stencil(float* f, int H, int W, const pipeline_stage* kernels, int kernel_count, int w_padding, int h_padding, float* output, int reduction, double tolerance);
+int verify_gaussian(float* f, int H, int W, double sigma, int w_padding, int h_padding, float* output, double tolerance);
+float* flip_kernel(float* g, int kH, int kW, int* fH, int* fW);
+int verify_weight_grad(float* f, int H, int W, float* grad_output, int kH, int kW, int w_padding, int h_padding, float* grad_kernel, double tolerance);
+
+// Hardware counters
+int start_perf_counters();
+int stop_perf_counters(perf_counts* totals, perf_counts* per_thread);
+long long perf_fp_ops(perf_counts* counts);
+int print_perf_report(perf_counts* totals, perf_counts* per_thread, int threads, double seconds, double flops, double bytes);
+
+#endif
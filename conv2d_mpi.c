@@ -0,0 +1,404 @@
+// Name: Liam Hearder       Student Number: 23074422
+// Name: Pranav Menon       Student Number: 24069351
+
+
+// ~~~~~~~~~~~~~~ CONTENTS ~~~~~~~~~~~~~~ //
+// 1. Includes and Defines
+// 2. band_rows()
+// 3. Parallel I/O: read_band(), write_band()
+// 4. Halo exchange: start_halo_exchange()
+// 5. main()
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ //
+
+
+// A multi-process driver for the convolution engines, for feature maps larger than one node's memory.
+// Each rank holds one band of rows, plus the padding_height rows of halo above and below it that its
+// windows reach into. Only those halos are exchanged with the neighbouring ranks, while the rows that
+// don't need them are already being computed. Feature maps and outputs are read and written with
+// collective MPI-IO, in the binary format, so no rank ever holds the whole map.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <mpi.h>
+
+#include "conv2d.h"
+
+// Message tags for halos travelling up (to the previous rank) and down (to the next)
+#define TAG_HALO_UP 1
+#define TAG_HALO_DOWN 2
+
+
+/*
+Splits H rows as evenly as possible over the ranks.
+@param H        The number of rows.
+@param rank     This rank.
+@param ranks    The number of ranks.
+@param first    The location where this rank's first row will be stored.
+@param count    The location where this rank's number of rows will be stored.
+*/
+void band_rows(int H, int rank, int ranks, int* first, int* count){
+    *first = (int)((long long)H * rank / ranks);
+    *count = (int)((long long)H * (rank + 1) / ranks) - *first;
+}
+
+
+/*
+Reads one band of rows from a binary file into the interior of a padded float array, with every rank
+reading its own band in one collective call. Reduced precision data is widened to float. The band is read
+as a count of whole rows, so bands over 2 GiB don't overflow MPI's int counts.
+@param filepath         The binary file to read.
+@param dtype            The file's DTYPE_, from its header.
+@param W                The width of the file's rows.
+@param first            The first row of the band.
+@param rows             The number of rows in the band.
+@param w_padding        The number of columns of padding in the array.
+@param h_padding        The number of rows of padding above the band in the array.
+@param output           The padded array to read into.
+*/
+int read_band(char* filepath, int dtype, int W, int first, int rows, int w_padding, int h_padding, float* output){
+
+    MPI_File file;
+    if (MPI_File_open(MPI_COMM_WORLD, filepath, MPI_MODE_RDONLY, MPI_INFO_NULL, &file) != MPI_SUCCESS) { return 1; }
+
+    const size_t element_size = dtype_size(dtype);
+    const size_t count = (size_t)rows * W;
+    char* band = (char*)malloc(count * element_size + 1);
+    if (band == NULL) { MPI_File_close(&file); return 1; }
+
+    MPI_Datatype row_type;
+    MPI_Type_contiguous((int)(W * element_size), MPI_BYTE, &row_type);
+    MPI_Type_commit(&row_type);
+
+    const MPI_Offset offset = BINARY_HEADER_SIZE + (MPI_Offset)first * W * element_size;
+    const int status = MPI_File_read_at_all(file, offset, band, rows, row_type, MPI_STATUS_IGNORE);
+    MPI_File_close(&file);
+    MPI_Type_free(&row_type);
+
+    const int total_width = W + w_padding*2;
+    for (int i = 0; i < rows; i++){
+        float* row = output + IDX(i + h_padding, w_padding, total_width);
+        if (dtype == DTYPE_FP32){
+            memcpy(row, band + (size_t)i * W * sizeof(float), W * sizeof(float));
+        } else {
+            convert_half_to_float((uint16_t*)band + (size_t)i * W, row, W, dtype);
+        }
+    }
+
+    free(band);
+    return status != MPI_SUCCESS;
+}
+
+
+/*
+Writes every rank's band of a (possibly padded) float array to one binary file, in one collective call.
+Rank 0 writes the header. As in read_band(), the band is written as a count of whole rows.
+@param filepath         The binary file to write.
+@param data             This rank's band.
+@param H                The height of the whole map.
+@param W                The width of the map.
+@param first            The first row of this rank's band.
+@param rows             The number of rows in the band.
+@param w_padding        The number of columns of padding in the band's array.
+@param h_padding        The number of rows of padding above the band in its array.
+*/
+int write_band(char* filepath, float* data, int H, int W, int first, int rows, int w_padding, int h_padding){
+
+    MPI_File file;
+    if (MPI_File_open(MPI_COMM_WORLD, filepath, MPI_MODE_WRONLY | MPI_MODE_CREATE, MPI_INFO_NULL, &file) != MPI_SUCCESS) { return 1; }
+    MPI_File_set_size(file, 0);
+
+    // Gather the band's rows without their padding
+    const int total_width = W + w_padding*2;
+    float* band = (float*)malloc((size_t)rows * W * sizeof(float) + 1);
+    if (band == NULL) { MPI_File_close(&file); return 1; }
+    for (int i = 0; i < rows; i++){
+        memcpy(band + (size_t)i * W, data + IDX(i + h_padding, w_padding, total_width), W * sizeof(float));
+    }
+
+    int rank;
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    if (rank == 0){
+        char header[BINARY_HEADER_SIZE];
+        const int32_t fields[3] = { DTYPE_FP32, H, W };
+        memcpy(header, BINARY_MAGIC, 4);
+        memcpy(header + 4, fields, sizeof(fields));
+        MPI_File_write_at(file, 0, header, BINARY_HEADER_SIZE, MPI_BYTE, MPI_STATUS_IGNORE);
+    }
+
+    MPI_Datatype row_type;
+    MPI_Type_contiguous(W, MPI_FLOAT, &row_type);
+    MPI_Type_commit(&row_type);
+
+    const MPI_Offset offset = BINARY_HEADER_SIZE + (MPI_Offset)first * W * sizeof(float);
+    const int status = MPI_File_write_at_all(file, offset, band, rows, row_type, MPI_STATUS_IGNORE);
+    MPI_File_close(&file);
+    MPI_Type_free(&row_type);
+
+    free(band);
+    return status != MPI_SUCCESS;
+}
+
+
+/*
+Starts exchanging halos with the neighbouring ranks: this band's first and last h_padding rows are sent
+up and down, and the neighbours' are received into the padding rows above and below it. Whole padded
+rows are sent, so each halo is one contiguous message. Ranks at the top and bottom keep their zero padding.
+@param band         This rank's padded band.
+@param rows         The number of rows in the band, excluding halos.
+@param total_width  The padded width of each row.
+@param h_padding    The number of halo rows above and below the band.
+@param requests     The location where the four requests will be stored, for MPI_Waitall().
+*/
+void start_halo_exchange(float* band, int rows, int total_width, int h_padding, MPI_Request* requests){
+
+    int rank, ranks;
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    MPI_Comm_size(MPI_COMM_WORLD, &ranks);
+
+    const int above = rank > 0 ? rank - 1 : MPI_PROC_NULL;
+    const int below = rank < ranks - 1 ? rank + 1 : MPI_PROC_NULL;
+    const int count = h_padding * total_width;
+
+    MPI_Irecv(band, count, MPI_FLOAT, above, TAG_HALO_DOWN, MPI_COMM_WORLD, &requests[0]);
+    MPI_Irecv(band + IDX(rows + h_padding, 0, total_width), count, MPI_FLOAT, below, TAG_HALO_UP, MPI_COMM_WORLD, &requests[1]);
+    MPI_Isend(band + IDX(h_padding, 0, total_width), count, MPI_FLOAT, above, TAG_HALO_UP, MPI_COMM_WORLD, &requests[2]);
+    MPI_Isend(band + IDX(rows, 0, total_width), count, MPI_FLOAT, below, TAG_HALO_DOWN, MPI_COMM_WORLD, &requests[3]);
+}
+
+
+int main(int argc, char** argv) {
+
+    // ~~~~~~~~~~~~~~~ MAIN CONTENTS ~~~~~~~~~~~~~~ //
+    // 1. Argument Extraction
+    // 2. Kernel
+    // 3. Feature Map Band
+    // 4. Convolution, overlapped with the Halo Exchange
+    // 5. Write Outputs and Report
+    // ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ //
+
+
+    // ~~~~~~~~~~~~~~~ 1. Argument Extraction ~~~~~~~~~~~~~~ //
+
+    MPI_Init(&argc, &argv);
+
+    int rank, ranks;
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    MPI_Comm_size(MPI_COMM_WORLD, &ranks);
+
+    // Different data on every run. Rank 0 picks the kernel and the map's seed, and broadcasts them.
+    srand(time(0));
+
+    int H = 0;                      // -H <int>
+    int W = 0;                      // -W <int>
+    int kH = 0;                     // -kH <int>
+    int kW = 0;                     // -kW <int>
+    char* feature_file = NULL;      // -f <path>
+    char* kernel_file = NULL;       // -g <path>
+    char* output_file = NULL;       // -o <path>
+    int threads = 1;                // -t <threads>, per rank
+    int benchmark_mode = 0;         // -b
+    int verify_mode = 0;            // -verify [tolerance]
+    double verify_tolerance = DEFAULT_VERIFY_TOLERANCE;
+
+    for (int i = 1; i < argc; i++) {
+        if (strncmp(argv[i], "--", 2) == 0) { argv[i]++; }
+
+        if (strcmp(argv[i], "-b") == 0) { benchmark_mode = 1; continue; }
+        if (strcmp(argv[i], "-verify") == 0) {
+            verify_mode = 1;
+            if (i + 1 < argc && argv[i + 1][0] != '-') { verify_tolerance = atof(argv[++i]); }
+            continue;
+        }
+        if (i + 1 >= argc) {
+            if (rank == 0) { printf("Incorrect usage of %s flag. Please provide a value.\n", argv[i]); }
+            MPI_Finalize();
+            return 1;
+        }
+
+        if (strcmp(argv[i], "-H") == 0) { H = atoi(argv[++i]); H = max(H, 1); continue; }
+        if (strcmp(argv[i], "-W") == 0) { W = atoi(argv[++i]); W = max(W, 1); continue; }
+        if (strcmp(argv[i], "-kH") == 0) { kH = atoi(argv[++i]); kH = max(kH, 1); continue; }
+        if (strcmp(argv[i], "-kW") == 0) { kW = atoi(argv[++i]); kW = max(kW, 1); continue; }
+        if (strcmp(argv[i], "-f") == 0) { feature_file = argv[++i]; continue; }
+        if (strcmp(argv[i], "-g") == 0) { kernel_file = argv[++i]; continue; }
+        if (strcmp(argv[i], "-o") == 0) { output_file = argv[++i]; continue; }
+        if (strcmp(argv[i], "-t") == 0) { threads = atoi(argv[++i]); threads = max(threads, 1); continue; }
+
+        if (rank == 0) { printf("Unknown flag %s.\n", argv[i]); }
+        MPI_Finalize();
+        return 1;
+    }
+
+    omp_set_num_threads(threads);
+
+    // Every rank reaches the same decision, so they can all stop together
+    #define FAIL(...) do { if (rank == 0) { printf(__VA_ARGS__); } MPI_Finalize(); return 1; } while (0)
+
+    if ((H == 0 && W == 0 && feature_file == NULL) || (kH == 0 && kW == 0 && kernel_file == NULL)){
+        FAIL("Please provide a feature map and a kernel, as files or dimensions to generate.\n");
+    }
+    if (output_file != NULL && !is_binary_path(output_file)){
+        FAIL("Outputs are written with parallel I/O, so -o must be a .bin path.\n");
+    }
+
+
+    // ~~~~~~~~~~~~~~~ 2. Kernel ~~~~~~~~~~~~~~ //
+
+    // The kernel is small, so rank 0 generates or extracts it, as conv2d does, and broadcasts it
+    const int generate_kernel = kH > 0 || kW > 0;
+    int status = 0;
+    if (generate_kernel){
+        kH = max(kH, 1);
+        kW = max(kW, 1);
+    } else if (rank == 0){
+        status = extract_dimensions(kernel_file, &kH, &kW);
+    }
+    MPI_Bcast(&status, 1, MPI_INT, 0, MPI_COMM_WORLD);
+    if (status != 0) { FAIL("Error extracting kernel dimensions from file.\n"); }
+
+    int kernel_dims[2] = { kH, kW };
+    MPI_Bcast(kernel_dims, 2, MPI_INT, 0, MPI_COMM_WORLD);
+    kH = kernel_dims[0];
+    kW = kernel_dims[1];
+
+    float* kernel = (float*)malloc((size_t)kH * kW * sizeof(float));
+    if (kernel == NULL) { FAIL("Error allocating memory for kernel.\n"); }
+    if (rank == 0){
+        if (generate_kernel){
+            generate_data(kH, kW, 0, 0, &kernel);
+            if (kernel_file != NULL){
+                status = is_binary_path(kernel_file)
+                    ? write_binary_file(kernel_file, kernel, kH, kW, 0, 0, DTYPE_FP32)
+                    : write_data_to_file(kernel_file, kernel, (float_array){0}, kH, kW, 0, 0);
+            }
+        } else {
+            status = extract_data(kernel_file, kW, kH, 0, 0, &kernel);
+        }
+    }
+    MPI_Bcast(&status, 1, MPI_INT, 0, MPI_COMM_WORLD);
+    if (status != 0) { FAIL("Error reading or writing the kernel file.\n"); }
+    MPI_Bcast(kernel, kH * kW, MPI_FLOAT, 0, MPI_COMM_WORLD);
+
+    const int padding_width = kW / 2;
+    const int padding_height = kH / 2;
+
+
+    // ~~~~~~~~~~~~~~~ 3. Feature Map Band ~~~~~~~~~~~~~~ //
+
+    int dtype = DTYPE_FP32;
+    const int generate = H > 0 || W > 0;
+    if (generate){
+        H = max(H, 1);
+        W = max(W, 1);
+    } else if (read_binary_header(feature_file, &dtype, &H, &W) != 0){
+        FAIL("Please provide the feature map as a binary file, which ranks can read in parallel.\n");
+    }
+
+    // One seed for the whole map, with each row seeded from its index, so any band can be regenerated
+    unsigned int map_seed = (unsigned int)rand();
+    MPI_Bcast(&map_seed, 1, MPI_UNSIGNED, 0, MPI_COMM_WORLD);
+
+    int first_row, rows;
+    band_rows(H, rank, ranks, &first_row, &rows);
+
+    // Halos come from the neighbouring bands only, so each band must be at least a halo deep
+    int smallest_band = rows;
+    MPI_Allreduce(MPI_IN_PLACE, &smallest_band, 1, MPI_INT, MPI_MIN, MPI_COMM_WORLD);
+    if (smallest_band < max(padding_height, 1)){
+        FAIL("Each of the %d ranks needs at least %d rows; please use fewer ranks.\n", ranks, max(padding_height, 1));
+    }
+
+    const int total_width = W + padding_width*2;
+    float* band = (float*)calloc((size_t)(rows + padding_height*2) * total_width, sizeof(float));
+    float* outputs = (float*)malloc((size_t)rows * W * sizeof(float));
+    if (band == NULL || outputs == NULL) { FAIL("Error allocating memory for the feature map band.\n"); }
+
+    if (generate){
+        generate_rows(map_seed, first_row, rows, W, padding_height, padding_width, &band);
+        if (feature_file != NULL && write_band(feature_file, band, H, W, first_row, rows, padding_width, padding_height) != 0){
+            FAIL("Error writing feature map to file.\n");
+        }
+    } else if (read_band(feature_file, dtype, W, first_row, rows, padding_width, padding_height, band) != 0){
+        FAIL("Error reading feature map band from file.\n");
+    }
+
+
+    // ~~~~~~~~~~~~~~~ 4. Convolution, overlapped with the Halo Exchange ~~~~~~~~~~~~~~ //
+
+    MPI_Barrier(MPI_COMM_WORLD);
+    const double start_time = MPI_Wtime();
+
+    MPI_Request requests[4];
+    start_halo_exchange(band, rows, total_width, padding_height, requests);
+
+    // Output rows [padding_height, rows - padding_height) only read this band's own rows. An engine given a
+    // sub-band reads from h_padding rows above its first output, so offsetting f and the outputs is enough.
+    const int interior_first = padding_height;
+    const int interior_rows = rows - padding_height*2;
+    if (interior_rows > 0){
+        deterministic_conv2d(band + IDX(interior_first, 0, total_width), interior_rows, W, kernel, kH, kW,
+            padding_width, padding_height, outputs + IDX(interior_first, 0, W));
+    }
+    const double interior_time = MPI_Wtime() - start_time;
+
+    MPI_Waitall(4, requests, MPI_STATUSES_IGNORE);
+
+    // The rows next to the halos, now they've arrived
+    if (interior_rows > 0){
+        deterministic_conv2d(band, padding_height, W, kernel, kH, kW, padding_width, padding_height, outputs);
+        deterministic_conv2d(band + IDX(rows - padding_height, 0, total_width), padding_height, W, kernel, kH, kW,
+            padding_width, padding_height, outputs + IDX(rows - padding_height, 0, W));
+    } else {
+        deterministic_conv2d(band, rows, W, kernel, kH, kW, padding_width, padding_height, outputs);
+    }
+
+    const double elapsed = MPI_Wtime() - start_time;
+
+
+    // ~~~~~~~~~~~~~~~ 5. Write Outputs and Report ~~~~~~~~~~~~~~ //
+
+    if (output_file != NULL && write_band(output_file, outputs, H, W, first_row, rows, 0, 0) != 0){
+        FAIL("Error writing outputs to file.\n");
+    }
+
+    // The slowest rank sets the time
+    double slowest = elapsed, slowest_interior = interior_time;
+    MPI_Reduce(&elapsed, &slowest, 1, MPI_DOUBLE, MPI_MAX, 0, MPI_COMM_WORLD);
+    MPI_Reduce(&interior_time, &slowest_interior, 1, MPI_DOUBLE, MPI_MAX, 0, MPI_COMM_WORLD);
+    if (benchmark_mode && rank == 0){
+        printf("%d ranks x %d threads, %d x %d map, %d x %d kernel, %zu halo bytes per boundary\n", ranks, threads, H, W, kH, kW,
+            (size_t)padding_height * total_width * sizeof(float));
+        printf("%f\n", slowest);
+        printf("Interior (overlapped with the halo exchange): %f\n", slowest_interior);
+    }
+
+    // Each rank checks its own band against the reference. The reference's halos are regenerated, or read
+    // from the file, rather than taken from the exchange, so a wrong exchange can't pass.
+    int failed = 0;
+    if (verify_mode){
+        if (rank != 0) { freopen("/dev/null", "w", stdout); }
+
+        const int first_halo = max(first_row - padding_height, 0);
+        const int last_halo = min(first_row + rows + padding_height, H);
+        const int skipped = first_halo - (first_row - padding_height);
+        float* reference_band = (float*)calloc((size_t)(rows + padding_height*2) * total_width, sizeof(float));
+        float* reference_rows = reference_band + IDX(skipped, 0, total_width);
+        failed = reference_band == NULL || (generate
+            ? generate_rows(map_seed, first_halo, last_halo - first_halo, W, 0, padding_width, &reference_rows)
+            : read_band(feature_file, dtype, W, first_halo, last_halo - first_halo, padding_width, skipped, reference_band));
+        if (failed) { printf("Error building the reference band.\n"); }
+
+        failed = failed || verify_outputs(reference_band, rows, W, kernel, kH, kW, padding_width, padding_height, outputs, verify_tolerance, 0.0) != 0;
+        free(reference_band);
+        MPI_Allreduce(MPI_IN_PLACE, &failed, 1, MPI_INT, MPI_MAX, MPI_COMM_WORLD);
+        if (rank == 0) { printf("%s on all %d ranks\n", failed ? "FAILED" : "PASSED", ranks); }
+    }
+
+    free(band);
+    free(outputs);
+    free(kernel);
+    MPI_Finalize();
+    return failed;
+}